@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#define CSFX_IMPL
+#include "csfx.h"
+
+#define _LIBNAME "./csfx-temp.so"
+#define _BUILD   "gcc -shared -fPIC -O2 -o " _LIBNAME " csfx-temp.c"
+
+static double _now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Round-trip of csfx_script_invoke, in-process against isolated */
+static void bench_invoke(int count)
+{
+    char input[64] = "csfx";
+    char output[64];
+    
+    csfx_script_t inproc;
+    csfx_script_t isolated;
+
+    csfx_script_init(&inproc, _LIBNAME);
+    if (csfx_script_init_isolated(&isolated, _LIBNAME) != 0)
+    {
+	fprintf(stderr, "Error: isolation mode is not supported\n");
+	csfx_script_free(&inproc);
+	return;
+    }
+    
+    csfx_script_update(&inproc);
+    csfx_script_update(&isolated);
+
+    int (*echo)(void*, const void*, int, void*, int);
+    echo = (int (*)(void*, const void*, int, void*, int))csfx_script_symbol(&inproc, "echo");
+
+    int    i;
+    double start;
+    
+    start = _now_us();
+    for (i = 0; i < count; i++)
+    {
+	echo(inproc.userdata, input, sizeof(input), output, sizeof(output));
+    }
+    printf("invoke: direct call     %10.3f us/call\n", (_now_us() - start) / count);
+
+    start = _now_us();
+    for (i = 0; i < count; i++)
+    {
+	csfx_script_invoke(&inproc, "echo", input, sizeof(input), output, sizeof(output));
+    }
+    printf("invoke: in-process      %10.3f us/call\n", (_now_us() - start) / count);
+
+    start = _now_us();
+    for (i = 0; i < count; i++)
+    {
+	csfx_script_invoke(&isolated, "echo", input, sizeof(input), output, sizeof(output));
+    }
+    printf("invoke: isolated        %10.3f us/call\n", (_now_us() - start) / count);
+
+    csfx_script_free(&isolated);
+    csfx_script_free(&inproc);
+}
+
+#define _LIBDIR "./csfx-bench-libs"
+
+/* Batch reload of many changed libraries, serial against loader threads */
+static void bench_reload(int count)
+{
+    char path[256];
+    char cmd[512];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s && mkdir -p %s", _LIBDIR, _LIBDIR);
+    if (system(cmd) != 0)
+    {
+	fprintf(stderr, "Error: cannot create %s\n", _LIBDIR);
+	return;
+    }
+
+    csfx_manager_t manager;
+    csfx_manager_init(&manager);
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+	snprintf(cmd, sizeof(cmd), "cp %s %s/lib%d.so", _LIBNAME, _LIBDIR, i);
+	snprintf(path, sizeof(path), "%s/lib%d.so", _LIBDIR, i);
+	if (system(cmd) != 0 || !csfx_manager_add(&manager, path))
+	{
+	    fprintf(stderr, "Error: cannot add %s\n", path);
+	    csfx_manager_free(&manager);
+	    return;
+	}
+    }
+    csfx_manager_update(&manager, NULL);
+
+    /* Move modify time forward instead of sleep, it has a resolution of seconds */
+    time_t stamp = time(NULL);
+    int    mode;
+    for (mode = 0; mode < 2; mode++)
+    {
+	struct utimbuf times;
+	times.actime = times.modtime = stamp + 1 + mode;
+	for (i = 0; i < count; i++)
+	{
+	    snprintf(path, sizeof(path), "%s/lib%d.so", _LIBDIR, i);
+	    utime(path, &times);
+	}
+
+	manager.threads = mode == 0 ? 1 : 0;
+	
+	double start = _now_us();
+	int    transitions = csfx_manager_update(&manager, NULL);
+	printf("reload: %3d libraries %-8s %10.3f ms (%d transitions)\n",
+	       count, mode == 0 ? "serial" : "parallel", (_now_us() - start) / 1e3, transitions);
+    }
+
+    csfx_manager_free(&manager);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", _LIBDIR);
+    system(cmd);
+}
+
+#define _HEADER "./csfx-bench-heavy.h"
+#define _SCRIPT "./csfx-bench-script.c"
+#define _SCRIPTLIB "./csfx-bench-script.so"
+
+static double _rebuild_ms(csfx_script_t* script, int count)
+{
+    double total = 0;
+    int    i;
+    for (i = 0; i < count; i++)
+    {
+	double start = _now_us();
+	csfx_script_compile(script);
+
+	int state;
+	while ((state = csfx_script_update(script)) != CSFX_BUILT && state != CSFX_BUILD_FAILED)
+	{
+	    usleep(100);
+	}
+	total += _now_us() - start;
+
+	if (state == CSFX_BUILD_FAILED)
+	{
+	    fprintf(stderr, "Error: build failed\n%s", csfx_script_buildlog(script));
+	    return -1;
+	}
+    }
+    return total / count / 1e3;
+}
+
+/* Rebuild of a small script including a large header, parsed by each compile or precompiled once */
+static void bench_build(int count)
+{
+    FILE* file = fopen(_HEADER, "w");
+    if (!file)
+    {
+	fprintf(stderr, "Error: cannot create %s\n", _HEADER);
+	return;
+    }
+
+    int i;
+    for (i = 0; i < 20000; i++)
+    {
+	fprintf(file, "static inline int heavy%d(int x) { return x * %d + heavy%d(x - 1); }\n", i, i, i > 0 ? i - 1 : 0);
+    }
+    fclose(file);
+
+    file = fopen(_SCRIPT, "w");
+    if (!file)
+    {
+	fprintf(stderr, "Error: cannot create %s\n", _SCRIPT);
+	return;
+    }
+    fprintf(file, "int script_value(void) { return 42; }\n");
+    fclose(file);
+
+    csfx_script_t script;
+    csfx_script_init(&script, _SCRIPTLIB);
+    csfx_script_build(&script, "gcc -shared -fPIC -include " _HEADER " -o " _SCRIPTLIB " " _SCRIPT);
+
+    printf("build: header parsed     %10.3f ms/rebuild\n", _rebuild_ms(&script, count));
+
+    if (csfx_build_pch(_HEADER, "gcc -fPIC -x c-header {src} -o {obj}") != 0)
+    {
+	fprintf(stderr, "Error: cannot precompile %s\n", _HEADER);
+    }
+    else
+    {
+	_rebuild_ms(&script, 1); /* Precompile header */
+	printf("build: precompiled      %10.3f ms/rebuild\n", _rebuild_ms(&script, count));
+
+	/* Compilers spawned by the resident server, header kept mapped there */
+	if (csfx_build_server("./csfx-bench-server") == 0)
+	{
+	    _rebuild_ms(&script, 1); /* Map header in server */
+	    printf("build: served + pch      %10.3f ms/rebuild\n", _rebuild_ms(&script, count));
+	    csfx_build_server(NULL);
+	    rmdir("./csfx-bench-server");
+	}
+	csfx_build_pch(NULL, NULL);
+    }
+
+    csfx_script_free(&script);
+    remove(_HEADER);
+    remove(_HEADER ".gch");
+    remove(_SCRIPT);
+    remove(_SCRIPTLIB);
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+
+    if (system(_BUILD) != 0)
+    {
+	fprintf(stderr, "Error: cannot build %s\n", _LIBNAME);
+	return 1;
+    }
+    
+    csfx_init();
+    bench_invoke(count);
+    bench_reload(1);
+    bench_reload(10);
+    bench_reload(100);
+    bench_build(10);
+    csfx_quit();
+    return 0;
+}
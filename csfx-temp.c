@@ -1,6 +1,17 @@
 #include <stdio.h>
+#include <string.h>
 #include "csfx.h"
 
+/* Copy input to output, used by csfx-bench */
+int echo(void* userdata, const void* input, int inlen, void* output, int outcap)
+{
+    int len = inlen < outcap ? inlen : outcap;
+
+    (void)userdata;
+    memcpy(output, input, len);
+    return len;
+}
+
 void* csfx_main(void* userdata, int old_state, int state)
 {
     int* ptr = NULL;
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -43,6 +45,13 @@ int main(int argc, char* argv[])
     csfx_script_t script;
     csfx_script_init(&script, _LIBNAME);
 
+    /* Compiler run in background, host keep running while it builds */
+#if defined(__TINYC__)
+    csfx_script_build(&script, "tcc -shared -o " _LIBNAME " csfx-temp.c");
+#else
+    csfx_script_build(&script, "gcc -shared -o " _LIBNAME " csfx-temp.c");
+#endif
+
     csfx_filetime_t files[] =
     {
 	{ 0, "./csfx-temp.c" }
@@ -56,14 +65,7 @@ int main(int argc, char* argv[])
     {
 	if (csfx_watch_files(files, sizeof(files) / sizeof(files[0])))
 	{
-#if defined(__TINYC__)
-	    system("tcc -shared -o " _LIBNAME " csfx-temp.c");
-#else
-	    system("gcc -shared -o " _LIBNAME " csfx-temp.c");
-#endif
-	    
-	    /* Update folders time after build */
-	    csfx_watch_files(files, sizeof(files) / sizeof(files[0]));
+	    csfx_script_compile(&script);
 	}
 
 	/* Reload module if has a newer library version */
@@ -74,10 +76,22 @@ int main(int argc, char* argv[])
 	    fprintf(stderr, "       %s\n", csfx_script_errmsg(&script));
 	    break;
 
+	case CSFX_BUILD_FAILED:
+	{
+	    const csfx_diagnostic_t* diags;
+	    int count = csfx_script_diagnostics(&script, &diags);
+	    for (int i = 0; i < count; i++)
+	    {
+		fprintf(stderr, "%s:%d: %s\n", diags[i].file, diags[i].line, diags[i].message);
+	    }
+	    break;
+	}
+
 	case CSFX_NONE:
 	case CSFX_INIT:
 	case CSFX_RELOAD:
 	case CSFX_UNLOAD:
+	case CSFX_BUILT:
 	    break;
 	    
 	default:
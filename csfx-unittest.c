@@ -0,0 +1,763 @@
+/* Checks of csfx internals and reload behaviors, exit status is the number of failures.
+ * gcc -o csfx-unittest csfx-unittest.c -ldl -lpthread -lrt && ./csfx-unittest
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <dlfcn.h>
+
+#define CSFX_IMPL
+#include "csfx.h"
+
+static int _failures;
+
+#define _CHECK(cond)                                                    \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            _failures++;                                                \
+        }                                                               \
+    } while (0)
+
+/* Files of checks are written there, removed at exit */
+#define _TMPDIR "csfx-unittest.tmp"
+
+static void _write(const char* path, const char* text)
+{
+    FILE* file = fopen(path, "wb");
+    if (file)
+    {
+        fputs(text, file);
+        fclose(file);
+    }
+}
+
+/* Compile script into a library with gcc or g++, renamed in place so no half-written one is seen */
+static int _build(const char* compiler, const char* name, const char* source)
+{
+    char path[256];
+    char command[1024];
+
+    snprintf(path, sizeof(path), _TMPDIR "/%s.c", name);
+    _write(path, source);
+    snprintf(command, sizeof(command),
+             "%s -shared -fPIC -I. -o " _TMPDIR "/%s.tmp %s && mv " _TMPDIR "/%s.tmp " _TMPDIR "/%s.so",
+             compiler, name, path, name, name);
+    return system(command) == 0;
+}
+
+/* Build output of GCC and MSVC, parsed into diagnostics */
+static void test_diagnostics(void)
+{
+    csfx_diagnostic_t diag;
+    const char*       line;
+
+    line = "src/game.c:12:5: error: 'x' undeclared (first use in this function)";
+    memset(&diag, 0, sizeof(diag));
+    _CHECK(csfx__build_parse_line(line, strlen(line), &diag));
+    _CHECK(strcmp(diag.file, "src/game.c") == 0);
+    _CHECK(diag.line == 12 && diag.column == 5);
+    _CHECK(diag.severity == CSFX_DIAG_ERROR);
+    _CHECK(strcmp(diag.message, "'x' undeclared (first use in this function)") == 0);
+
+    line = "game.c:7: warning: unused variable 'y'";
+    memset(&diag, 0, sizeof(diag));
+    _CHECK(csfx__build_parse_line(line, strlen(line), &diag));
+    _CHECK(diag.line == 7 && diag.column == 0);
+    _CHECK(diag.severity == CSFX_DIAG_WARNING);
+
+    line = "game.c:1:10: fatal error: missing.h: No such file or directory";
+    memset(&diag, 0, sizeof(diag));
+    _CHECK(csfx__build_parse_line(line, strlen(line), &diag));
+    _CHECK(diag.severity == CSFX_DIAG_ERROR);
+    _CHECK(strcmp(diag.message, "missing.h: No such file or directory") == 0);
+
+    line = "C:\\work\\game.c(42,17): error C2065: 'x': undeclared identifier";
+    memset(&diag, 0, sizeof(diag));
+    _CHECK(csfx__build_parse_line(line, strlen(line), &diag));
+    _CHECK(strcmp(diag.file, "C:\\work\\game.c") == 0);
+    _CHECK(diag.line == 42 && diag.column == 17);
+    _CHECK(diag.severity == CSFX_DIAG_ERROR);
+    _CHECK(strcmp(diag.message, "'x': undeclared identifier") == 0);
+
+    line = "game.c(3): warning C4101: 'y': unreferenced local variable";
+    memset(&diag, 0, sizeof(diag));
+    _CHECK(csfx__build_parse_line(line, strlen(line), &diag));
+    _CHECK(diag.line == 3 && diag.column == 0);
+    _CHECK(diag.severity == CSFX_DIAG_WARNING);
+
+    line = "In file included from game.c:1:";
+    _CHECK(!csfx__build_parse_line(line, strlen(line), &diag));
+    line = "collect2: error: ld returned 1 exit status";
+    _CHECK(!csfx__build_parse_line(line, strlen(line), &diag));
+}
+
+typedef struct
+{
+    int  count;
+    char paths[8][64];
+} _deps_t;
+
+static void _deps_visit(void* userdata, const char* path)
+{
+    _deps_t* deps = (_deps_t*)userdata;
+    if (deps->count < 8)
+    {
+        snprintf(deps->paths[deps->count++], sizeof(deps->paths[0]), "%s", path);
+    }
+}
+
+/* Make rule written by -MMD, with escaped spaces and continuation lines */
+static void test_depfile(void)
+{
+    _write(_TMPDIR "/my file.d",
+           _TMPDIR "/my\\ file.o: src/my\\ file.c include/a\\ b.h \\\r\n"
+           "  include/c.h\r\n"
+           "\r\n"
+           "include/a\\ b.h:\n");
+
+    _deps_t deps;
+    memset(&deps, 0, sizeof(deps));
+    _CHECK(csfx__build_deps(_TMPDIR "/my file.o", _deps_visit, &deps) == 0);
+    _CHECK(deps.count == 3);
+    _CHECK(strcmp(deps.paths[0], "src/my file.c") == 0);
+    _CHECK(strcmp(deps.paths[1], "include/a b.h") == 0);
+    _CHECK(strcmp(deps.paths[2], "include/c.h") == 0);
+
+    memset(&deps, 0, sizeof(deps));
+    _CHECK(csfx__build_deps(_TMPDIR "/none.o", _deps_visit, &deps) == -1);
+    _CHECK(deps.count == 0);
+}
+
+/* Index of first transition of script to state, -1 when none */
+static int _find(const csfx_transition_t* transitions, int count, int start, csfx_script_t* script, int state)
+{
+    int idx;
+    for (idx = start; idx < count; idx++)
+    {
+        if (transitions[idx].script == script && transitions[idx].state == state)
+        {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+#define _SCRIPT(version) \
+    "void* csfx_main(void* userdata, int old_state, int new_state)\n" \
+    "{ (void)old_state; (void)new_state; return userdata; }\n" \
+    "int version(void) { return " #version "; }\n"
+
+static int _version(csfx_script_t* script)
+{
+    int (*version)(void) = (int (*)(void))csfx_script_symbol(script, "version");
+    return version ? version() : 0;
+}
+
+/* Dependents are unloaded before and reloaded after what they depend on, cycles are refused */
+static void test_depend(void)
+{
+    _CHECK(_build("gcc", "a", _SCRIPT(1)) && _build("gcc", "b", _SCRIPT(1)) && _build("gcc", "c", _SCRIPT(1)) && _build("gcc", "d", _SCRIPT(1)));
+
+    csfx_manager_t manager;
+    _CHECK(csfx_manager_init(&manager) == 0);
+    csfx_script_t* a = csfx_manager_add(&manager, _TMPDIR "/a.so");
+    csfx_script_t* b = csfx_manager_add(&manager, _TMPDIR "/b.so");
+    csfx_script_t* c = csfx_manager_add(&manager, _TMPDIR "/c.so");
+    csfx_script_t* d = csfx_manager_add(&manager, _TMPDIR "/d.so");
+    _CHECK(csfx_manager_depend(&manager, c, b) == 0);
+    _CHECK(csfx_manager_depend(&manager, b, a) == 0);
+    _CHECK(csfx_manager_depend(&manager, a, c) == -1);
+    _CHECK(csfx_manager_depend(&manager, a, a) == -1);
+
+    const csfx_transition_t* transitions;
+    int count = csfx_manager_update(&manager, &transitions);
+    _CHECK(count == 4);
+    _CHECK(_find(transitions, count, 0, a, CSFX_INIT) >= 0);
+    _CHECK(_find(transitions, count, 0, d, CSFX_INIT) >= 0);
+
+    _CHECK(_build("gcc", "a", _SCRIPT(2)));
+    count = csfx_manager_update(&manager, &transitions);
+    _CHECK(count == 6);
+
+    int unloadc = _find(transitions, count, 0, c, CSFX_UNLOAD);
+    int unloadb = _find(transitions, count, 0, b, CSFX_UNLOAD);
+    int unloada = _find(transitions, count, 0, a, CSFX_UNLOAD);
+    int reloada = _find(transitions, count, 0, a, CSFX_RELOAD);
+    int reloadb = _find(transitions, count, 0, b, CSFX_RELOAD);
+    int reloadc = _find(transitions, count, 0, c, CSFX_RELOAD);
+    _CHECK(unloadc >= 0 && unloadc < unloadb && unloadb < unloada);
+    _CHECK(unloada < reloada && reloada < reloadb && reloadb < reloadc);
+    _CHECK(_find(transitions, count, 0, d, CSFX_UNLOAD) == -1);
+    _CHECK(_version(a) == 2 && _version(b) == 1 && _version(d) == 1);
+
+    count = csfx_manager_update(&manager, &transitions);
+    _CHECK(count == 0);
+
+    csfx_manager_free(&manager);
+}
+
+/* Version 2 of y crashes in its reload, 4 is CSFX_RELOAD */
+#define _SCRIPT_CRASH(version) \
+    "void* csfx_main(void* userdata, int old_state, int new_state)\n" \
+    "{ (void)old_state; if (new_state == 4) *(volatile int*)0 = 0; return userdata; }\n" \
+    "int version(void) { return " #version "; }\n"
+
+/* One failed reload of a transaction sends every script back to its previous version */
+static void test_rollback(void)
+{
+    _CHECK(_build("gcc", "x", _SCRIPT(1)) && _build("gcc", "y", _SCRIPT(1)));
+
+    csfx_manager_t manager;
+    _CHECK(csfx_manager_init(&manager) == 0);
+    csfx_script_t* x = csfx_manager_add(&manager, _TMPDIR "/x.so");
+    csfx_script_t* y = csfx_manager_add(&manager, _TMPDIR "/y.so");
+
+    const csfx_transition_t* transitions;
+    int count = csfx_manager_update(&manager, &transitions);
+    _CHECK(count == 2);
+
+    csfx_reload_begin(&manager);
+    _CHECK(_build("gcc", "x", _SCRIPT(2)) && _build("gcc", "y", _SCRIPT_CRASH(2)));
+    count = csfx_manager_update(&manager, &transitions);
+    _CHECK(count == 0);
+    _CHECK(_version(x) == 1 && _version(y) == 1);
+
+    _CHECK(csfx_reload_commit(&manager, &transitions, &count) == -1);
+    _CHECK(_version(x) == 1 && _version(y) == 1);
+    _CHECK(x->state != CSFX_FAILED && y->state != CSFX_FAILED);
+
+    int last = -1;
+    int idx;
+    for (idx = 0; idx < count; idx++)
+    {
+        if (transitions[idx].script == x && transitions[idx].state == CSFX_RELOAD)
+        {
+            last = idx;
+        }
+    }
+    _CHECK(_find(transitions, count, 0, x, CSFX_UNLOAD) >= 0);
+    _CHECK(_find(transitions, count, 0, y, CSFX_UNLOAD) >= 0);
+    _CHECK(last >= 0 && _find(transitions, count, last + 1, x, CSFX_UNLOAD) == -1);
+
+    /* Tried again together with the next change */
+    _CHECK(_build("gcc", "y", _SCRIPT(3)));
+    count = csfx_manager_update(&manager, &transitions);
+    _CHECK(_find(transitions, count, 0, x, CSFX_RELOAD) >= 0);
+    _CHECK(_find(transitions, count, 0, y, CSFX_RELOAD) >= 0);
+    _CHECK(_version(x) == 2 && _version(y) == 3);
+
+    csfx_manager_free(&manager);
+}
+
+#define _SCRIPT_C(version) \
+    "#include \"csfx.h\"\n" \
+    "static int counter;\n" \
+    "static int reset CSFX_TRANSIENT;\n" \
+    "void* csfx_main(void* userdata, int old_state, int new_state)\n" \
+    "{ (void)old_state; if (new_state == CSFX_INIT || new_state == CSFX_RELOAD) { counter++; reset++; } return userdata; }\n" \
+    "int counter_get(void) { return counter; }\n" \
+    "int reset_get(void) { return reset; }\n" \
+    "int version(void) { return " #version "; }\n"
+
+static int _get(csfx_script_t* script, const char* symbol)
+{
+    int (*get)(void) = (int (*)(void))csfx_script_symbol(script, symbol);
+    return get ? get() : -1;
+}
+
+/* Globals of a C script are carried by default, CSFX_TRANSIENT ones start over */
+static void test_persist_c(void)
+{
+    _CHECK(_build("gcc", "c", _SCRIPT_C(1)));
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/c.so");
+    _CHECK(csfx_script_update(&script) == CSFX_INIT);
+    _CHECK(_get(&script, "counter_get") == 1 && _get(&script, "reset_get") == 1);
+
+    _CHECK(_build("gcc", "c", _SCRIPT_C(2)));
+    _CHECK(csfx_script_update(&script) == CSFX_UNLOAD);
+    _CHECK(csfx_script_update(&script) == CSFX_RELOAD);
+    _CHECK(_version(&script) == 2);
+    _CHECK(_get(&script, "counter_get") == 2 && _get(&script, "reset_get") == 1);
+
+    csfx_script_free(&script);
+}
+
+#define _SCRIPT_CXX(version) \
+    "#include <string>\n" \
+    "#include \"csfx.h\"\n" \
+    "static int         counter CSFX_PERSIST;\n" \
+    "static std::string name(\"v" #version "\");\n" \
+    "static std::string& cached() { static std::string text(\"cached v" #version "\"); return text; }\n" \
+    "void* csfx_main(void* userdata, int old_state, int new_state)\n" \
+    "{ (void)old_state; if (new_state == CSFX_INIT || new_state == CSFX_RELOAD) counter++; return userdata; }\n" \
+    "extern \"C\" int counter_get() { return counter; }\n" \
+    "extern \"C\" const char* name_get() { return name.c_str(); }\n" \
+    "extern \"C\" const char* cached_get() { return cached().c_str(); }\n"
+
+static const char* _text(csfx_script_t* script, const char* symbol)
+{
+    const char* (*get)(void) = (const char* (*)(void))csfx_script_symbol(script, symbol);
+    return get ? get() : "";
+}
+
+/* Plain data marked CSFX_PERSIST is carried, C++ objects are constructed again by the new version */
+static void test_persist_cxx(void)
+{
+    _CHECK(_build("g++", "p", _SCRIPT_CXX(1)));
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/p.so");
+    _CHECK(csfx_script_update(&script) == CSFX_INIT);
+
+    int (*counter)(void) = (int (*)(void))csfx_script_symbol(&script, "counter_get");
+    _CHECK(counter && counter() == 1);
+    _CHECK(strcmp(_text(&script, "name_get"), "v1") == 0);
+    _CHECK(strcmp(_text(&script, "cached_get"), "cached v1") == 0);
+
+    _CHECK(_build("g++", "p", _SCRIPT_CXX(2)));
+    _CHECK(csfx_script_update(&script) == CSFX_UNLOAD);
+    _CHECK(csfx_script_update(&script) == CSFX_RELOAD);
+
+    counter = (int (*)(void))csfx_script_symbol(&script, "counter_get");
+    _CHECK(counter && counter() == 2);
+    _CHECK(strcmp(_text(&script, "name_get"), "v2") == 0);
+    _CHECK(strcmp(_text(&script, "cached_get"), "cached v2") == 0);
+
+    csfx_script_free(&script);
+}
+
+/* Wait for the build of script, CSFX_BUILT or CSFX_BUILD_FAILED, other states are counted */
+static int _wait_build(csfx_script_t* script, int* events)
+{
+    int idx, state = CSFX_NONE;
+    for (idx = 0; idx < 3000; idx++)
+    {
+        state = csfx_script_update(script);
+        if (state == CSFX_BUILT || state == CSFX_BUILD_FAILED)
+        {
+            return state;
+        }
+        *events += state != CSFX_NONE;
+        usleep(1000);
+    }
+    return state;
+}
+
+static volatile int _holding;
+
+/* Stay in a guarded call of script until _holding is cleared */
+static void* _hold(void* script)
+{
+    csfx_script_invoke((csfx_script_t*)script, "hold", NULL, 0, NULL, 0);
+    return NULL;
+}
+
+/* A changed unit is patched into the loaded library: old entries run the new code, no reload.
+ * A patch is not written while another thread is in a guarded call of the library */
+static void test_patch(void)
+{
+    const char* sources[] = { _TMPDIR "/u1.c", _TMPDIR "/u2.c" };
+    _write(sources[0], "int value(void) { volatile int x = 1; return x * 10; }\n");
+    _write(sources[1], "int value(void);\nint call(void) { return value(); }\n"
+                       "int hold(void* u, const void* in, int inlen, void* out, int outcap)\n"
+                       "{ (void)in; (void)inlen; (void)out; (void)outcap; while (*(volatile int*)u) {} return 0; }\n");
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/u.so");
+    _CHECK(csfx_script_build_units(&script, "gcc -fPIC -MMD -c {src} -o {obj}", "gcc -shared -o {out} {objs}", sources, 2) == 0);
+    _CHECK(csfx_script_build_patch(&script, "gcc -shared -o {out} {objs} {base}") == 0);
+    _CHECK(csfx_script_compile(&script) == 0);
+
+    int events = 0;
+    _CHECK(_wait_build(&script, &events) == CSFX_BUILT);
+    int idx;
+    for (idx = 0; idx < 100 && csfx_script_update(&script) != CSFX_INIT; idx++)
+    {
+        usleep(1000);
+    }
+
+    int (*value)(void) = (int (*)(void))csfx_script_symbol(&script, "value");
+    int (*call)(void)  = (int (*)(void))csfx_script_symbol(&script, "call");
+    _CHECK(value && call && value() == 10 && call() == 10);
+
+    _write(sources[0], "int value(void) { volatile int x = 2; return x * 10; }\n");
+    _CHECK(csfx_script_compile(&script) == 0);
+    events = 0;
+    _CHECK(_wait_build(&script, &events) == CSFX_BUILT);
+    for (idx = 0; idx < 20; idx++)
+    {
+        events += csfx_script_update(&script) != CSFX_NONE;
+        usleep(1000);
+    }
+    _CHECK(events == 0);
+    _CHECK(value && call && value() == 20 && call() == 20);
+
+    /* Patched while a call runs: accepted, written once it returned */
+    pthread_t thread;
+    _holding        = 1;
+    script.userdata = (void*)&_holding;
+    _CHECK(pthread_create(&thread, NULL, _hold, &script) == 0);
+    usleep(50000);
+
+    _write(sources[0], "int value(void) { volatile int x = 3; return x * 10; }\n");
+    _CHECK(csfx_script_compile(&script) == 0);
+    events = 0;
+    _CHECK(_wait_build(&script, &events) == CSFX_BUILT);
+    _CHECK(events == 0);
+    _CHECK(value && value() == 20);
+
+    _holding = 0;
+    pthread_join(thread, NULL);
+    for (idx = 0; idx < 20; idx++)
+    {
+        events += csfx_script_update(&script) != CSFX_NONE;
+        usleep(1000);
+    }
+    _CHECK(events == 0);
+    _CHECK(value && call && value() == 30 && call() == 30);
+
+    csfx_script_free(&script);
+}
+
+/* A call over its budget is interrupted, one within it returns normally */
+static void test_timeout(void)
+{
+    _CHECK(_build("gcc", "t", "void spin(void* u) { (void)u; for (;;) {} }\nvoid quick(void* u) { *(int*)u = 1; }\n"));
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/t.so");
+    _CHECK(csfx_script_update(&script) == CSFX_INIT);
+
+    int done = 0;
+    script.userdata = &done;
+    void (*spin)(void*)  = (void (*)(void*))csfx_script_symbol(&script, "spin");
+    void (*quick)(void*) = (void (*)(void*))csfx_script_symbol(&script, "quick");
+    _CHECK(spin && csfx_script_call_timeout(&script, spin, 20000) == CSFX_ERROR_TIMEOUT);
+    _CHECK(quick && csfx_script_call_timeout(&script, quick, 20000) == CSFX_ERROR_NONE && done == 1);
+
+    csfx_script_free(&script);
+}
+
+#define _SCRIPT_ARENA \
+    "#include \"csfx.h\"\n" \
+    "csfx_arena_t* csfx_arena;\n" \
+    "typedef struct node { struct node* next; int value; } node_t;\n" \
+    "void* csfx_main(void* userdata, int old_state, int new_state)\n" \
+    "{\n" \
+    "    (void)old_state;\n" \
+    "    node_t* list = (node_t*)userdata;\n" \
+    "    int     i;\n" \
+    "    for (i = 1; new_state == CSFX_INIT && !userdata && i <= 3; i++)\n" \
+    "    {\n" \
+    "        node_t* node = (node_t*)csfx_arena_alloc(csfx_arena, sizeof(node_t));\n" \
+    "        node->value  = i;\n" \
+    "        node->next   = list;\n" \
+    "        list         = node;\n" \
+    "    }\n" \
+    "    return list;\n" \
+    "}\n"
+
+typedef struct _node
+{
+    struct _node* next;
+    int           value;
+} _node_t;
+
+/* Sum of the list of an arena script, -1 when the script has no state */
+static int _sum(csfx_script_t* script)
+{
+    int      sum  = script->userdata ? 0 : -1;
+    _node_t* node = (_node_t*)script->userdata;
+    for (; node; node = node->next)
+    {
+        sum += node->value;
+    }
+    return sum;
+}
+
+/* A snapshot is restored only at its old address, a moved image would keep pointers into the old one */
+static void test_snapshot(void)
+{
+    _CHECK(_build("gcc", "s", _SCRIPT_ARENA));
+
+    csfx_script_t first;
+    csfx_script_init(&first, _TMPDIR "/s.so");
+    _CHECK(csfx_script_update(&first) == CSFX_INIT);
+    _CHECK(_sum(&first) == 6);
+    _CHECK(csfx_script_snapshot(&first, _TMPDIR "/s.snap") == 0);
+
+    /* Address still taken by the first arena */
+    csfx_script_t moved;
+    csfx_script_init(&moved, _TMPDIR "/s.so");
+    _CHECK(csfx_script_restore(&moved, _TMPDIR "/s.snap") == -1);
+    _CHECK(csfx_script_update(&moved) == CSFX_INIT);
+    _CHECK(_sum(&moved) == 6 && csfx_script_arena(&moved)->base != csfx_script_arena(&first)->base);
+    csfx_script_free(&moved);
+
+    char* base = csfx_script_arena(&first)->base;
+    csfx_script_free(&first);
+
+    csfx_script_t restored;
+    csfx_script_init(&restored, _TMPDIR "/s.so");
+    _CHECK(csfx_script_restore(&restored, _TMPDIR "/s.snap") == 0);
+    _CHECK(csfx_script_arena(&restored)->base == base);
+    _CHECK(csfx_script_update(&restored) == CSFX_INIT);
+    _CHECK(_sum(&restored) == 6);
+    csfx_script_free(&restored);
+}
+
+static sigjmp_buf   _chained_env;
+static volatile int _chained;
+
+/* Handler installed before csfx_init, faults csfx does not own reach it */
+static void _chained_handler(int code, siginfo_t* info, void* context)
+{
+    (void)info;
+    (void)context;
+    if (!_chained)
+    {
+        signal(code, SIG_DFL);
+        return;
+    }
+    _chained = 0;
+    siglongjmp(_chained_env, 1);
+}
+
+/* In a guarded call, faults of script text or of a leaf function it called are handled.
+ * A fault in a host library is chained even inside csfx_try */
+static void test_fault(void)
+{
+    _CHECK(_build("gcc", "f",
+                  "#include <string.h>\n"
+                  "void crash(void* u) { (void)u; *(volatile int*)0 = 0; }\n"
+                  "void copy(void* u) { volatile size_t n = 64; memcpy((void*)(size_t)16, u, n); }\n"));
+    _CHECK(_build("gcc", "h", "void host_crash(void) { *(volatile int*)0 = 0; }\n"));
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/f.so");
+    _CHECK(csfx_script_update(&script) == CSFX_INIT);
+
+    char buffer[64] = { 0 };
+    script.userdata = buffer;
+    void (*crash)(void*) = (void (*)(void*))csfx_script_symbol(&script, "crash");
+    void (*copy)(void*)  = (void (*)(void*))csfx_script_symbol(&script, "copy");
+    _CHECK(crash && csfx_script_call_timeout(&script, crash, 0) == CSFX_ERROR_SEGFAULT);
+    _CHECK(copy && csfx_script_call_timeout(&script, copy, 0) == CSFX_ERROR_SEGFAULT);
+
+    void* host = dlopen(_TMPDIR "/h.so", RTLD_NOW);
+    void (*host_crash)(void) = host ? (void (*)(void))dlsym(host, "host_crash") : NULL;
+    _CHECK(host_crash != NULL);
+
+    /* Recovered inside the body, so the frame is left as usual */
+    volatile int owned = 0;
+    _chained = 1;
+    csfx_try (&script)
+    {
+        if (host_crash && sigsetjmp(_chained_env, 1) == 0)
+        {
+            host_crash();
+        }
+    }
+    csfx_except (&script)
+    {
+        owned = 1;
+    }
+    _CHECK(!owned && !_chained);
+    _chained = 0;
+
+    if (host)
+    {
+        dlclose(host);
+    }
+    csfx_script_free(&script);
+}
+
+/* Unbounded recursion of script is stopped, and the thread can call it again */
+static void test_overflow(void)
+{
+    _CHECK(_build("gcc", "o",
+                  "int deep(int n) { volatile char frame[256]; frame[0] = (char)n; return deep(n + 1) + frame[0]; }\n"
+                  "void run(void* u) { *(int*)u = deep(0); }\n"
+                  "void quick(void* u) { *(int*)u = 1; }\n"));
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/o.so");
+    _CHECK(csfx_script_update(&script) == CSFX_INIT);
+
+    int done = 0;
+    script.userdata = &done;
+    void (*run)(void*)   = (void (*)(void*))csfx_script_symbol(&script, "run");
+    void (*quick)(void*) = (void (*)(void*))csfx_script_symbol(&script, "quick");
+    _CHECK(run && csfx_script_call_timeout(&script, run, 0) == CSFX_ERROR_STACKOVERFLOW);
+    _CHECK(run && csfx_script_call_timeout(&script, run, 0) == CSFX_ERROR_STACKOVERFLOW);
+    _CHECK(quick && csfx_script_call_timeout(&script, quick, 0) == CSFX_ERROR_NONE && done == 1);
+
+    csfx_script_free(&script);
+}
+
+static csfx_script_t* _nested;
+
+/* Fault of a guarded call on another thread, handled by the frames of that thread */
+static void* _crash_thread(void* result)
+{
+    void (*crash)(void*) = (void (*)(void*))csfx_script_symbol(_nested, "crash");
+    *(int*)result = crash ? csfx_script_call_timeout(_nested, crash, 0) : -1;
+    return NULL;
+}
+
+/* A fault unwinds to the innermost guarded call only, outer ones go on */
+static void test_nested(void)
+{
+    _CHECK(_build("gcc", "n",
+                  "void crash(void* u) { (void)u; *(volatile int*)0 = 0; }\n"
+                  "void quick(void* u) { (void)u; }\n"));
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/n.so");
+    _CHECK(csfx_script_update(&script) == CSFX_INIT);
+    _nested = &script;
+
+    void (*crash)(void*) = (void (*)(void*))csfx_script_symbol(&script, "crash");
+    void (*quick)(void*) = (void (*)(void*))csfx_script_symbol(&script, "quick");
+    _CHECK(crash && quick);
+
+    volatile int inner = -1;
+    volatile int after = 0;
+    volatile int outer = 0;
+    csfx_try (&script)
+    {
+        inner = crash ? csfx_script_call_timeout(&script, crash, 0) : -1;
+        after = 1;
+    }
+    csfx_except (&script)
+    {
+        outer = 1;
+    }
+    _CHECK(inner == CSFX_ERROR_SEGFAULT && after && !outer && script.errcode == CSFX_ERROR_NONE);
+
+    /* Inner call returned, a fault after it unwinds to the outer one */
+    inner = -1;
+    csfx_try (&script)
+    {
+        inner = quick ? csfx_script_call_timeout(&script, quick, 0) : -1;
+        if (crash)
+        {
+            crash(NULL);
+        }
+    }
+    csfx_except (&script)
+    {
+        outer = 1;
+    }
+    _CHECK(inner == CSFX_ERROR_NONE && outer && script.errcode == CSFX_ERROR_SEGFAULT);
+
+    int       result = -1;
+    pthread_t thread;
+    _CHECK(pthread_create(&thread, NULL, _crash_thread, &result) == 0 && pthread_join(thread, NULL) == 0);
+    _CHECK(result == CSFX_ERROR_SEGFAULT);
+
+    csfx_script_free(&script);
+}
+
+/* Commands of builds run by a server on a socket of a private directory, not by the host.
+ * Status of a failed command comes back with its output */
+static void test_server(void)
+{
+    mkdir(_TMPDIR "/open", 0755);
+    _CHECK(csfx_build_server(_TMPDIR "/open") == -1);
+    _CHECK(csfx_build_server(_TMPDIR "/srv") == 0);
+
+    struct stat st;
+    _CHECK(stat(_TMPDIR "/srv", &st) == 0 && (st.st_mode & 0777) == 0700);
+
+    const char* sources[] = { _TMPDIR "/v.c" };
+    _write(sources[0], "int value(void) { return 5; }\n");
+
+    csfx_script_t script;
+    csfx_script_init(&script, _TMPDIR "/v.so");
+    _CHECK(csfx_script_build_units(&script, "echo $PPID > " _TMPDIR "/v.ppid && gcc -fPIC -c {src} -o {obj}",
+                                   "gcc -shared -o {out} {objs}", sources, 1) == 0);
+    _CHECK(csfx_script_compile(&script) == 0);
+
+    int events = 0;
+    _CHECK(_wait_build(&script, &events) == CSFX_BUILT);
+    int idx;
+    for (idx = 0; idx < 100 && csfx_script_update(&script) != CSFX_INIT; idx++)
+    {
+        usleep(1000);
+    }
+    int (*value)(void) = (int (*)(void))csfx_script_symbol(&script, "value");
+    _CHECK(value && value() == 5);
+
+    int   ppid = 0;
+    FILE* file = fopen(_TMPDIR "/v.ppid", "r");
+    _CHECK(file && fscanf(file, "%d", &ppid) == 1);
+    _CHECK(ppid > 0 && ppid != (int)getpid());
+    if (file)
+    {
+        fclose(file);
+    }
+
+    _write(sources[0], "int value(void) { return x; }\n");
+    _CHECK(csfx_script_compile(&script) == 0);
+    events = 0;
+    _CHECK(_wait_build(&script, &events) == CSFX_BUILD_FAILED);
+    _CHECK(csfx_script_diagnostics(&script, NULL) > 0);
+
+    csfx_script_free(&script);
+    _CHECK(csfx_build_server(NULL) == 0);
+    _CHECK(access(_TMPDIR "/srv/build.sock", F_OK) != 0);
+}
+
+int main(void)
+{
+    mkdir(_TMPDIR, 0755);
+
+    /* Actions set before csfx_init are given back by csfx_quit */
+    struct sigaction chained;
+    memset(&chained, 0, sizeof(chained));
+    chained.sa_sigaction = _chained_handler;
+    chained.sa_flags     = SA_SIGINFO | SA_NODEFER;
+    sigaction(SIGSEGV, &chained, NULL);
+    signal(CSFX_TIMEOUT_SIGNAL, SIG_IGN);
+    csfx_init();
+
+    test_diagnostics();
+    test_depfile();
+    test_depend();
+    test_rollback();
+    test_persist_c();
+    test_persist_cxx();
+    test_patch();
+    test_timeout();
+    test_snapshot();
+    test_fault();
+    test_overflow();
+    test_nested();
+    test_server();
+
+    csfx_quit();
+
+    struct sigaction action;
+    _CHECK(sigaction(CSFX_TIMEOUT_SIGNAL, NULL, &action) == 0 && action.sa_handler == SIG_IGN);
+
+    if (system("rm -rf " _TMPDIR) != 0)
+    {
+        fprintf(stderr, "Error: cannot remove " _TMPDIR "\n");
+    }
+
+    printf("%s: %d failure(s)\n", _failures ? "FAILED" : "ok", _failures);
+    return _failures;
+}
@@ -10,6 +10,11 @@
 #define __csfx__
 #endif
 
+/* Implementation use GNU extensions on Linux (pthread_getattr_np, ...) */
+#if defined(CSFX_IMPL) && defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #if defined(__cplusplus)
 # define CSFX_EXTERN_C     extern "C" {
 # define CSFX_EXTERN_C_END }
@@ -18,6 +23,8 @@
 # define CSFX_EXTERN_C_END
 #endif
 
+#include <stddef.h>
+
 CSFX_EXTERN_C;
 /* BEGIN EXTERN "C" */
 
@@ -32,6 +39,10 @@ enum
     CSFX_UNLOAD,
     CSFX_RELOAD,
     CSFX_FAILED,
+
+    /* Completion of build, returned by update only */
+    CSFX_BUILT,
+    CSFX_BUILD_FAILED,
 };
 
 /**
@@ -47,6 +58,7 @@ enum
     CSFX_ERROR_SEGFAULT,
     CSFX_ERROR_OUTBOUNDS,
     CSFX_ERROR_STACKOVERFLOW,
+    CSFX_ERROR_TIMEOUT,
 };
 
 /** 
@@ -69,6 +81,151 @@ typedef struct
     const char* path;
 } csfx_filetime_t;
 
+/**
+ * Scripts manager data structure
+ */
+typedef struct
+{
+    int   count;
+    int   threads;  /* Threads loading changed libraries, 0 is CSFX_LOAD_THREADS */
+    void* internal;
+} csfx_manager_t;
+
+/**
+ * State transition of a script of manager
+ */
+typedef struct
+{
+    csfx_script_t* script;
+    int            state;
+} csfx_transition_t;
+
+/**
+ * Maximum frames captured in a fault backtrace
+ */
+#ifndef CSFX_MAX_BACKTRACE
+#define CSFX_MAX_BACKTRACE 16
+#endif
+
+/**
+ * Fault data structure, captured when a guarded call failed
+ */
+typedef struct
+{
+    int   errcode;
+    int   signo;
+    void* addr;                       /* Faulting address            */
+    void* pc;                         /* Program counter             */
+    int   depth;                      /* Number of captured frames   */
+    void* frames[CSFX_MAX_BACKTRACE]; /* Backtrace, frames[0] is pc  */
+} csfx_fault_t;
+
+/**
+ * Diagnostic severity
+ */
+enum
+{
+    CSFX_DIAG_NOTE,
+    CSFX_DIAG_WARNING,
+    CSFX_DIAG_ERROR,
+};
+
+/**
+ * Diagnostic of compiler, parsed from its output
+ */
+typedef struct
+{
+    int  severity;
+    int  line;
+    int  column;      /* 0 when unknown */
+    char file[256];
+    char message[512];
+} csfx_diagnostic_t;
+
+/**
+ * Script arena, growable and mmap-backed, with bump and size-class allocation.
+ * Owned by the host, survive reloads, released at once on quit.
+ * Script receive it by exporting: csfx_arena_t* csfx_arena;
+ * @note: not thread-safe, allocate from one thread at a time
+ */
+typedef struct csfx_live csfx_live_t;
+typedef struct csfx_arena csfx_arena_t;
+
+/**
+ * Live polymorphic object of script, its vtable pointers are re-seated on reload
+ * by the vtable of same type in the new version. Allocated from arena
+ */
+struct csfx_live
+{
+    csfx_live_t* prev;
+    csfx_live_t* next;
+    void*        object;
+    size_t       size;
+    char         type[1]; /* Mangled name of dynamic type */
+};
+
+struct csfx_arena
+{
+    void* (*alloc)(csfx_arena_t* arena, size_t size);
+    void  (*free)(csfx_arena_t* arena, void* ptr);
+
+    size_t used;      /* Bytes in use by live blocks           */
+    size_t limit;     /* Budget of used bytes, 0 is unlimited  */
+
+    char*  base;      /* Start of reserved address range       */
+    size_t top;       /* Bump offset from base                 */
+    size_t committed; /* Accessible bytes from base            */
+    size_t reserved;  /* Reserved bytes from base              */
+
+    csfx_live_t* live;    /* Live objects, see csfx::live<T>   */
+    void*  freelists[64]; /* Free blocks, by log2 of size      */
+};
+
+#define csfx_arena_alloc(arena, size) ((arena)->alloc((arena), (size)))
+#define csfx_arena_free(arena, ptr)   ((arena)->free((arena), (ptr)))
+
+/**
+ * Field types of a state layout
+ */
+enum
+{
+    CSFX_FIELD_BYTES, /* Raw bytes, copied up to the smaller size */
+    CSFX_FIELD_INT,   /* Signed integer of 1, 2, 4 or 8 bytes     */
+    CSFX_FIELD_UINT,  /* Unsigned integer of 1, 2, 4 or 8 bytes   */
+    CSFX_FIELD_FLOAT, /* float or double                          */
+    CSFX_FIELD_PTR,   /* Pointer, copied as is                    */
+};
+
+typedef struct
+{
+    const char* name;
+    int         type;
+    unsigned    offset;
+    unsigned    size;
+} csfx_field_t;
+
+/**
+ * State layout descriptor, exported by script as: const csfx_layout_t csfx_layout;
+ * When version or size change on reload, userdata is migrated field by field
+ * by name, new fields are zeroed, removed fields are dropped
+ */
+typedef struct
+{
+    int                 version;
+    unsigned            size;   /* sizeof state struct */
+    int                 count;
+    const csfx_field_t* fields;
+} csfx_layout_t;
+
+#define CSFX_FIELD(type, s, member) \
+    { #member, type, (unsigned)offsetof(s, member), (unsigned)sizeof(((s*)0)->member) }
+
+/**
+ * Script function type for csfx_script_invoke
+ * @return: length of output, negative on error
+ */
+typedef int (*csfx_invoke_f)(void* userdata, const void* input, int inlen, void* output, int outcap);
+
 /** Hot reload library API **/
 
 __csfx__ int   csfx_init(void);
@@ -79,6 +236,15 @@ __csfx__ void  csfx_quit(void);
  */
 __csfx__ void  csfx_script_init(csfx_script_t* script, const char* path);
 
+/**
+ * Initialize script in isolation mode, library is loaded in a child worker process,
+ * functions are called by csfx_script_invoke through a shared memory ring.
+ * A crash of script restarts the child, the host is never touched. The child is spawned from
+ * CSFX_ISOLATE_HELPER and killed when it does not respond within CSFX_ISOLATE_TIMEOUT.
+ * @return: 0 on success, -1 when isolation is not supported
+ */
+__csfx__ int   csfx_script_init_isolated(csfx_script_t* script, const char* path);
+
 /**
  * Free memory usage by script, unload library and raise quit event
  */
@@ -94,11 +260,171 @@ __csfx__ int   csfx_script_update(csfx_script_t* script);
  */
 __csfx__ void* csfx_script_symbol(csfx_script_t* script, const char* name);
 
+/**
+ * Invoke a script function by name, function type is csfx_invoke_f.
+ * In isolation mode, input and output are copied through the ring
+ * @return: length of output, or -1 on error with script->errcode
+ */
+__csfx__ int   csfx_script_invoke(csfx_script_t* script, const char* name,
+                                  const void* input, int inlen, void* output, int outcap);
+
+/**
+ * Call a script function with userdata as a guarded call,
+ * interrupted with CSFX_ERROR_TIMEOUT when run out of budget.
+ * The budget needs per-thread timers (Linux), func is not called when it cannot be armed
+ * @return: error code of the call, -1 when the budget cannot be armed
+ */
+__csfx__ int   csfx_script_call_timeout(csfx_script_t* script, void (*func)(void*), long budget_us);
+
+/**
+ * Begin/end a guarded region on calling thread. Inside csfx_try, only faults
+ * that originate in script code are handled: in script text, or in a leaf function
+ * called from it. Other faults are chained to the previous handlers.
+ * While a region is active, all faults are handled.
+ */
+__csfx__ void  csfx_guard_begin(void);
+__csfx__ void  csfx_guard_end(void);
+
+/**
+ * Get arena of script, the host can read used bytes and set limit
+ */
+__csfx__ csfx_arena_t* csfx_script_arena(csfx_script_t* script);
+
+/**
+ * Migrate count records from one layout to another, in bulk
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int csfx_layout_migrate(const csfx_layout_t* to, void* dst,
+                                 const csfx_layout_t* from, const void* src, size_t count);
+
+/**
+ * Register a region of script state, scanned for pointers into the old library on reload.
+ * Arena of script is always scanned. Size 0 unregister the region
+ * @note: scan run only when CSFX_STALE_SCAN is on, default in debug build
+ */
+__csfx__ int csfx_script_region(csfx_script_t* script, void* ptr, size_t size);
+
+/**
+ * Get report of stale pointers of last reload, empty when none were left
+ */
+__csfx__ const char* csfx_script_stalemsg(const csfx_script_t* script);
+
+/**
+ * Save arena and userdata of script to a file, to restore them on next start
+ * @return: 0 on success, -1 on failure
+ * @note: userdata must be NULL or allocated from arena, not supported in isolation mode
+ */
+__csfx__ int csfx_script_snapshot(csfx_script_t* script, const char* path);
+
+/**
+ * Map a snapshot back as arena of script, call it after csfx_script_init and before first update.
+ * CSFX_INIT receive the saved userdata, pointers to symbols of script are fixed
+ * @note: the arena must map back at its old address, pointers inside it are kept as they are
+ * @return: 0 on success, -1 on failure or when the old address is taken, then CSFX_INIT starts cold
+ */
+__csfx__ int csfx_script_restore(csfx_script_t* script, const char* path);
+
 /**
  * Get error message of script
  */
 __csfx__ const char* csfx_script_errmsg(const csfx_script_t* script);
 
+/**
+ * Get fault of the last failed guarded call of script
+ */
+__csfx__ const csfx_fault_t* csfx_script_fault(const csfx_script_t* script);
+
+/**
+ * Get symbolized fault report of script, resolved against the version that faulted
+ */
+__csfx__ const char* csfx_script_faultmsg(const csfx_script_t* script);
+
+/**
+ * Set compiler command of script, run with the shell. NULL to remove it
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int csfx_script_build(csfx_script_t* script, const char* command);
+
+/**
+ * Set compiler commands of script built from many sources, run with the shell. NULL link to remove them
+ * compile is run for each source with {src} and {obj} replaced, object is source with .o extension,
+ * only when object is older than source or than headers of its .d file (as written by -MMD).
+ * link is run with {objs} and {out} replaced, only when an object is newer than library.
+ * Compilers of all scripts run in parallel, at most CSFX_BUILD_JOBS at once (0 for number of cores)
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int csfx_script_build_units(csfx_script_t* script, const char* compile, const char* link,
+                                     const char* const* sources, int count);
+
+/**
+ * Start compiler of script in background, a compile requested while one runs start after it.
+ * csfx_script_update returns CSFX_BUILT or CSFX_BUILD_FAILED when it completed,
+ * new library is reloaded by next updates
+ * @return: 0 on success, -1 without command
+ */
+__csfx__ int csfx_script_compile(csfx_script_t* script);
+
+/**
+ * Set optimized build of script, started after each successful build and cancelled by a new compile.
+ * command is run with the shell, {out} replaced by a temporary path moved over library when it succeeds,
+ * csfx_script_update returns CSFX_BUILT or CSFX_BUILD_FAILED again when it completed. NULL to remove it.
+ * With units, {objs} is replaced by the objects of the fast build: command only relinks them,
+ * so it must compile the sources itself to optimize them.
+ * Set after csfx_script_build or csfx_script_build_units, they remove it
+ * @return: 0 on success, -1 without build or on failure
+ */
+__csfx__ int csfx_script_build_tier(csfx_script_t* script, const char* command);
+
+/**
+ * Set patch of script built from units: changed units are linked into a small library loaded beside
+ * the current one, whose exported functions jump to their new version instead of a reload.
+ * command is run with the shell, {objs} replaced by changed objects, {out} by patch path and {base}
+ * by the loaded library to link against. Library is still relinked for next loads, and reloaded when
+ * changed units define data or csfx_ objects, or a function too short for a jump. NULL to remove it.
+ * Set after csfx_script_build_units, it removes it. Only ELF on x86-64 and AArch64 are patched.
+ * Jumps are written only while no guarded call (csfx_try, csfx_script_invoke, csfx_script_call_timeout)
+ * runs in the library, until then old code runs and the next updates retry. Other calls are not seen:
+ * functions from csfx_script_symbol must not run on other threads during csfx_script_update
+ * @return: 0 on success, -1 without units build or on failure
+ */
+__csfx__ int csfx_script_build_patch(csfx_script_t* script, const char* command);
+
+/**
+ * Get diagnostics of last completed build of script
+ * @return: number of diagnostics
+ */
+__csfx__ int csfx_script_diagnostics(const csfx_script_t* script, const csfx_diagnostic_t** diagnostics);
+
+/**
+ * Get output of compiler of last completed build, NULL when none
+ */
+__csfx__ const char* csfx_script_buildlog(const csfx_script_t* script);
+
+/**
+ * Set directory of compile cache, created when missing. NULL to disable it (default).
+ * Objects of csfx_script_build_units and their libraries are keyed by a hash of command, compiler,
+ * source and headers, a unit with same inputs as a cached one is restored without compiling
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int csfx_build_cache(const char* directory);
+
+/**
+ * Keep a precompiled header of all builds: before compiling units, command is run with {src} and {obj}
+ * replaced by header and header.gch whenever the header or a file of its make rule changed.
+ * Compile commands with -include header skip parsing it. NULL header to stop
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int csfx_build_pch(const char* header, const char* command);
+
+/**
+ * Run commands of builds by a resident server (Linux only), spawned once from CSFX_BUILD_HELPER.
+ * Its socket is bound in directory, created with mode 0700 and refused when others can enter it,
+ * connections of other users are refused. The server keeps the precompiled header mapped, exits
+ * with the host, builds spawn compilers themselves whenever it is unreachable. NULL to stop
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int csfx_build_server(const char* directory);
+
 #if defined(_WIN32)
 /* Undocumented, should not call by hand */
 __csfx__ int csfx__seh_filter(csfx_script_t* script, unsigned long code);
@@ -111,18 +437,37 @@ __csfx__ int csfx__seh_filter(csfx_script_t* script, unsigned long code);
 #elif (__unix__)
 # include <signal.h>
 # include <setjmp.h>
+/* Guard frames live on the stack of caller, linked per thread,
+ * a fault unwinds to the innermost frame only. The error stays in the frame
+ * until the frame is left, then it is copied to script.
+ * @note: do not return or break out of the body of csfx_try
+ */
 # define csfx_try(s)							\
-    (s)->errcode = sigsetjmp(csfx__jmpenv, 0);				\
-    if ((s)->errcode == 0) (s)->errcode = CSFX_ERROR_NONE;		\
-    if ((s)->errcode == CSFX_ERROR_NONE)
+    for (csfx__frame_t csfx__frame, * volatile csfx__fptr = csfx__frame_new(&csfx__frame, (s)); \
+         csfx__frame_enter(csfx__fptr);					\
+         csfx__frame_leave(csfx__fptr, (s)))				\
+        if (sigsetjmp(csfx__frame.env, 0) == 0)
 
 # define csfx_except(s) else if (csfx__errcode_filter(s))
 # define csfx_finally   
-# define csfx__errcode_filter(s)					\
-    (s)->errcode > CSFX_ERROR_NONE					\
-    && (s)->errcode <= CSFX_ERROR_STACKOVERFLOW
+# define csfx__errcode_filter(s) csfx__fault_filter((s), &csfx__frame)
+
+typedef struct csfx__frame
+{
+    struct csfx__frame* prev;
+    int                 state;
+    int                 errcode;
+    int                 calls;    /* Slot of library whose active calls it counts, -1 when none */
+    csfx_script_t*      script;
+    long long           deadline;
+    sigjmp_buf          env;
+} csfx__frame_t;
 
-extern __thread sigjmp_buf csfx__jmpenv;
+/* Undocumented, should not call by hand */
+__csfx__ csfx__frame_t* csfx__frame_new(csfx__frame_t* frame, csfx_script_t* script);
+__csfx__ int            csfx__frame_enter(csfx__frame_t* frame);
+__csfx__ void           csfx__frame_leave(csfx__frame_t* frame, csfx_script_t* script);
+__csfx__ int            csfx__fault_filter(csfx_script_t* script, const csfx__frame_t* frame);
 #else
 # include <signal.h>
 # include <setjmp.h>
@@ -135,7 +480,7 @@ extern __thread sigjmp_buf csfx__jmpenv;
 # define csfx_finally   
 # define csfx__errcode_filter(s)					\
     (s)->errcode > CSFX_ERROR_NONE					\
-    && (s)->errcode <= CSFX_ERROR_STACKOVERFLOW
+    && (s)->errcode <= CSFX_ERROR_TIMEOUT
 
 extern
 # if defined(__MINGW32__)
@@ -160,6 +505,69 @@ jmp_buf csfx__jmpenv;
  */
 __csfx__ int csfx_watch_files(csfx_filetime_t* files, int count);
 
+/**
+ * Initialize a manager of scripts, they share one watcher of files
+ * @return: 0 on success, -1 on failure
+ */
+__csfx__ int  csfx_manager_init(csfx_manager_t* manager);
+
+/**
+ * Free manager and all of its scripts
+ */
+__csfx__ void csfx_manager_free(csfx_manager_t* manager);
+
+/**
+ * Add a script to manager, it is owned by manager and loaded on next update
+ * @return: NULL on failure
+ */
+__csfx__ csfx_script_t* csfx_manager_add(csfx_manager_t* manager, const char* libpath);
+
+/**
+ * Declare that script resolve symbols of dependency. When a script changes, its dependents
+ * are unloaded in reverse order of dependencies and reloaded in order, in the same update
+ * @return: 0 on success, -1 when it would make a cycle
+ */
+__csfx__ int  csfx_manager_depend(csfx_manager_t* manager, csfx_script_t* script, csfx_script_t* dependency);
+
+/**
+ * Remove a script from manager, and free it
+ */
+__csfx__ void csfx_manager_remove(csfx_manager_t* manager, csfx_script_t* script);
+
+/**
+ * Discover libraries of directory matching pattern ("*.so" or "*.dll" when NULL).
+ * New ones are added as they appear, ones that disappear get CSFX_QUIT and are removed
+ * @return: 0 on success, -1 on failure
+ * @note: quitted scripts in transitions are valid until next update
+ */
+__csfx__ int  csfx_plugin_dir(csfx_manager_t* manager, const char* path, const char* pattern);
+
+/**
+ * Update changed scripts and their dependents only, unload and load happen in one update
+ * @return: number of transitions, they are valid until next update
+ * @note: on Linux, no script is touched when nothing changed
+ * @note: libraries are loaded on worker threads, their constructors (static initializers of C++,
+ *        __attribute__((constructor))) run there, not on the calling thread. Set threads to 1 for this one only
+ */
+__csfx__ int  csfx_manager_update(csfx_manager_t* manager, const csfx_transition_t** transitions);
+
+/**
+ * Begin a reload transaction, updates of manager keep changes until it is committed
+ */
+__csfx__ void csfx_reload_begin(csfx_manager_t* manager);
+
+/**
+ * Stage every changed script and its dependents loaded beside the current versions,
+ * then flip them all at once, and try them again with the next change when one fails.
+ * When one cannot be loaded, no script is touched and no event is raised.
+ * When one fails its CSFX_INIT or CSFX_RELOAD, the flip is undone by events, all in transitions:
+ * every script got CSFX_UNLOAD, the ones before the failed one got CSFX_RELOAD of the new version
+ * and get CSFX_UNLOAD again, then every script gets CSFX_RELOAD of its current version.
+ * That version starts from the globals and userdata the new one left, not the ones it had
+ * @return: 0 when committed, -1 when rolled back. Transitions are valid until next update
+ */
+__csfx__ int  csfx_reload_commit(csfx_manager_t* manager, const csfx_transition_t** transitions, int* count);
+
 /**
  * Script main function
  */
@@ -170,6 +578,40 @@ extern
 #endif
 void* csfx_main(void* userdata, int old_state, int new_state);
 
+/**
+ * Writable globals of a C script are copied to the new version before CSFX_RELOAD,
+ * matched by name and size. Mark one CSFX_TRANSIENT to keep the initial value of the new version.
+ * A library with C++ symbols carries only globals marked CSFX_PERSIST: only plain data can be
+ * carried, never mark C++ objects with constructors or destructors
+ */
+#if defined(__GNUC__) && !defined(_WIN32) && !defined(__APPLE__)
+# define CSFX_PERSIST   __attribute__((section("csfx_persist")))
+# define CSFX_TRANSIENT __attribute__((section("csfx_transient")))
+#else
+# define CSFX_PERSIST
+# define CSFX_TRANSIENT
+#endif
+
+/**
+ * Script arena, optional, set by host before csfx_main is called
+ */
+#if defined(_WIN32) || defined(__CYGWIN__)
+extern __declspec(dllexport)
+#else
+extern
+#endif
+csfx_arena_t* csfx_arena;
+
+/**
+ * State layout, optional, userdata must be allocated from csfx_arena to be migrated
+ */
+#if defined(_WIN32) || defined(__CYGWIN__)
+extern __declspec(dllexport)
+#else
+extern
+#endif
+const csfx_layout_t csfx_layout;
+
 /* END OF EXTERN "C" */
 CSFX_EXTERN_C_END;
 
@@ -177,9 +619,16 @@ CSFX_EXTERN_C_END;
  * @region: C++ API wrapper
  */
 #ifdef __cplusplus
+#include <typeinfo>
+#include <string.h>
+
 namespace csfx
 {
-    typedef ::csfx_filetime_t filetime_t;
+    typedef ::csfx_filetime_t   filetime_t;
+    typedef ::csfx_fault_t      fault_t;
+    typedef ::csfx_diagnostic_t diagnostic_t;
+    typedef ::csfx_manager_t    manager_t;
+    typedef ::csfx_transition_t transition_t;
 
     union script_t
     {
@@ -235,11 +684,87 @@ namespace csfx
             return (type_t*)::csfx_script_symbol(script, name);
         }
 
+        inline int invoke(script_t& script, const char* name,
+                          const void* input, int inlen, void* output, int outcap)
+        {
+            return ::csfx_script_invoke(script, name, input, inlen, output, outcap);
+        }
+
+        inline bool snapshot(script_t& script, const char* path)
+        {
+            return ::csfx_script_snapshot(script, path) == 0;
+        }
+
+        inline bool restore(script_t& script, const char* path)
+        {
+            return ::csfx_script_restore(script, path) == 0;
+        }
+
+        inline ::csfx_arena_t* arena(script_t& script)
+        {
+            return ::csfx_script_arena(script);
+        }
+
+        inline int call_timeout(script_t& script, void (*func)(void*), long budget_us)
+        {
+            return ::csfx_script_call_timeout(script, func, budget_us);
+        }
+
         inline const char* errmsg(const script_t& script)
         {
             return ::csfx_script_errmsg(script);
         }
 
+        inline const fault_t* fault(const script_t& script)
+        {
+            return ::csfx_script_fault(script);
+        }
+
+        inline const char* stalemsg(const script_t& script)
+        {
+            return ::csfx_script_stalemsg(script);
+        }
+
+        inline const char* faultmsg(const script_t& script)
+        {
+            return ::csfx_script_faultmsg(script);
+        }
+
+        inline bool build(script_t& script, const char* command)
+        {
+            return ::csfx_script_build(script, command) == 0;
+        }
+
+        inline bool build(script_t& script, const char* compile, const char* link, const char* const* sources, int count)
+        {
+            return ::csfx_script_build_units(script, compile, link, sources, count) == 0;
+        }
+
+        inline bool build_tier(script_t& script, const char* command)
+        {
+            return ::csfx_script_build_tier(script, command) == 0;
+        }
+
+        inline bool build_patch(script_t& script, const char* command)
+        {
+            return ::csfx_script_build_patch(script, command) == 0;
+        }
+
+        inline bool compile(script_t& script)
+        {
+            return ::csfx_script_compile(script) == 0;
+        }
+
+        inline int diagnostics(const script_t& script, const diagnostic_t** diagnostics)
+        {
+            return ::csfx_script_diagnostics(script, diagnostics);
+        }
+
+        inline const char* buildlog(const script_t& script)
+        {
+            return ::csfx_script_buildlog(script);
+        }
+
         inline int update(script_t* script)
         {
             return ::csfx_script_update(*script);
@@ -256,27 +781,235 @@ namespace csfx
             return (type_t*)::csfx_script_symbol(*script, name);
         }
 
-        inline const char* errmsg(const script_t* script)
+        inline int invoke(script_t* script, const char* name,
+                          const void* input, int inlen, void* output, int outcap)
         {
-            return ::csfx_script_errmsg(*script);
+            return ::csfx_script_invoke(*script, name, input, inlen, output, outcap);
         }
-    }
-    
-    inline bool watch_files(filetime_t* files, int count)
-    {
-        return ::csfx_watch_files(files, count);
-    }
 
-    template <int count>
-    inline bool watch_files(filetime_t files[count])
-    {
-        return ::csfx_watch_files(files, count);
-    }
-}
-#endif
-/* @endregion: C++ API... */
+        inline bool snapshot(script_t* script, const char* path)
+        {
+            return ::csfx_script_snapshot(*script, path) == 0;
+        }
 
-#endif /* __CSFX_H__ */
+        inline bool restore(script_t* script, const char* path)
+        {
+            return ::csfx_script_restore(*script, path) == 0;
+        }
+
+        inline ::csfx_arena_t* arena(script_t* script)
+        {
+            return ::csfx_script_arena(*script);
+        }
+
+        inline int call_timeout(script_t* script, void (*func)(void*), long budget_us)
+        {
+            return ::csfx_script_call_timeout(*script, func, budget_us);
+        }
+
+        inline const char* errmsg(const script_t* script)
+        {
+            return ::csfx_script_errmsg(*script);
+        }
+
+        inline const fault_t* fault(const script_t* script)
+        {
+            return ::csfx_script_fault(*script);
+        }
+
+        inline const char* stalemsg(const script_t* script)
+        {
+            return ::csfx_script_stalemsg(*script);
+        }
+
+        inline const char* faultmsg(const script_t* script)
+        {
+            return ::csfx_script_faultmsg(*script);
+        }
+
+        inline bool build(script_t* script, const char* command)
+        {
+            return ::csfx_script_build(*script, command) == 0;
+        }
+
+        inline bool build(script_t* script, const char* compile, const char* link, const char* const* sources, int count)
+        {
+            return ::csfx_script_build_units(*script, compile, link, sources, count) == 0;
+        }
+
+        inline bool build_tier(script_t* script, const char* command)
+        {
+            return ::csfx_script_build_tier(*script, command) == 0;
+        }
+
+        inline bool build_patch(script_t* script, const char* command)
+        {
+            return ::csfx_script_build_patch(*script, command) == 0;
+        }
+
+        inline bool compile(script_t* script)
+        {
+            return ::csfx_script_compile(*script) == 0;
+        }
+
+        inline int diagnostics(const script_t* script, const diagnostic_t** diagnostics)
+        {
+            return ::csfx_script_diagnostics(*script, diagnostics);
+        }
+
+        inline const char* buildlog(const script_t* script)
+        {
+            return ::csfx_script_buildlog(*script);
+        }
+    }
+    
+    inline bool watch_files(filetime_t* files, int count)
+    {
+        return ::csfx_watch_files(files, count);
+    }
+
+    template <int count>
+    inline bool watch_files(filetime_t files[count])
+    {
+        return ::csfx_watch_files(files, count);
+    }
+
+    inline bool build_cache(const char* directory)
+    {
+        return ::csfx_build_cache(directory) == 0;
+    }
+
+    inline bool build_pch(const char* header, const char* command = NULL)
+    {
+        return ::csfx_build_pch(header, command) == 0;
+    }
+
+    inline bool build_server(const char* directory)
+    {
+        return ::csfx_build_server(directory) == 0;
+    }
+
+    /**
+     * Handle of a long-lived polymorphic object of script, keep it in userdata.
+     * The object is registered in the arena, vtable pointers in its first sizeof(U)
+     * bytes are re-seated once on reload, access cost nothing more than a pointer.
+     * U is the static type of the pointer given to reset, it must be the dynamic type
+     * of the object, so vtables of derived parts are re-seated too
+     * @note: type must have external linkage and exported vtable (Itanium ABI)
+     */
+    template <typename T>
+    class live
+    {
+    public:
+        inline live(void)
+            : object(0)
+            , node(0)
+            , arena(0)
+        {
+        }
+
+        template <typename U>
+        inline explicit live(U* object, ::csfx_arena_t* arena = ::csfx_arena)
+            : object(0)
+            , node(0)
+            , arena(0)
+        {
+            reset(object, arena);
+        }
+
+        inline ~live(void)
+        {
+            reset();
+        }
+
+    public:
+        inline T* get(void) const
+        {
+            return object;
+        }
+
+        inline T* operator->(void) const
+        {
+            return object;
+        }
+
+        inline T& operator*(void) const
+        {
+            return *object;
+        }
+
+        inline operator bool(void) const
+        {
+            return object != 0;
+        }
+
+    public:
+        inline bool reset(void)
+        {
+            if (node)
+            {
+                if (node->prev) node->prev->next = node->next;
+                else            arena->live      = node->next;
+                if (node->next) node->next->prev = node->prev;
+                csfx_arena_free(arena, node);
+            }
+
+            object = 0;
+            node   = 0;
+            arena  = 0;
+            return true;
+        }
+
+        /* Fail when U is not the dynamic type, sizeof(U) would miss the derived part */
+        template <typename U>
+        inline bool reset(U* newobject, ::csfx_arena_t* newarena = ::csfx_arena)
+        {
+            reset();
+
+            object = newobject;
+            if (!newobject || !newarena)
+            {
+                return !newobject;
+            }
+
+            if (typeid(*newobject) != typeid(U))
+            {
+                return false;
+            }
+
+            const char* type = typeid(*newobject).name();
+            size_t      len  = strlen(type);
+            node = (::csfx_live_t*)csfx_arena_alloc(newarena, sizeof(::csfx_live_t) + len);
+            if (!node)
+            {
+                return false;
+            }
+
+            memcpy(node->type, type, len + 1);
+            node->object = newobject;
+            node->size   = sizeof(U);
+            node->prev   = 0;
+            node->next   = newarena->live;
+            if (node->next) node->next->prev = node;
+            newarena->live = node;
+            arena = newarena;
+            return true;
+        }
+
+    private:
+        live(const live&);
+        live& operator=(const live&);
+
+    private:
+        T*              object;
+        ::csfx_live_t*  node;
+        ::csfx_arena_t* arena;
+    };
+}
+#endif
+/* @endregion: C++ API... */
+
+#endif /* __CSFX_H__ */
 
 
 /* --------------------------------------------- */
@@ -301,6 +1034,28 @@ namespace csfx
 /* BEGIN OF CSFX_IMPL */
 
 #define CSFX__MAX_PATH 256
+#define CSFX__MAX_FAULTMSG 4096
+
+/* Scan state for pointers into unloaded library, default on in debug build */
+#ifndef CSFX_STALE_SCAN
+# if defined(NDEBUG)
+#  define CSFX_STALE_SCAN 0
+# else
+#  define CSFX_STALE_SCAN 1
+# endif
+#endif
+
+typedef struct
+{
+    char*  ptr;
+    size_t size;
+} csfx__region_t;
+
+typedef struct
+{
+    char*       from;
+    const char* to;
+} csfx__jump_t;
 
 typedef struct
 {
@@ -308,7 +1063,7 @@ typedef struct
 
 #if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
     int   delpdb;
-    long  libtime;
+    long long libtime;
     long  pdbtime;
     
     char  librpath[CSFX__MAX_PATH];
@@ -316,15 +1071,32 @@ typedef struct
     char  pdbrpath[CSFX__MAX_PATH];
     char  pdbtpath[CSFX__MAX_PATH];
 #else
-    long  libtime;
+    long long libtime;
     
     char  librpath[CSFX__MAX_PATH];
     char  libtpath[CSFX__MAX_PATH];
 #endif
+
+    csfx_fault_t fault;
+    char         faultmsg[CSFX__MAX_FAULTMSG];
+    volatile int faultlock;
+
+    void*          isolate;  /* Child worker process, NULL when in-process */
+    csfx_arena_t   arena;
+    csfx_layout_t* layout;   /* Copy of layout of unloaded library        */
+
+    csfx__region_t* regions; /* State regions scanned for stale pointers */
+    int             regioncount;
+    int             regioncapacity;
+    void*           stale;   /* Stale pointers found on unload           */
+    char            stalemsg[CSFX__MAX_FAULTMSG];
+
+    void*           build;   /* Compiler job, NULL without build command */
 } csfx__script_data_t;
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Define dynamic library loading API */
 #if defined(_WIN32)
@@ -360,6 +1132,32 @@ static const char* csfx__dlib_errmsg(void)
 #  error "Unsupported platform"
 #endif
 
+/* Embedded TinyCC, opt-in: script with .c path is compiled into memory */
+#if defined(CSFX_LIBTCC)
+#  include "libtcc.h"
+
+/* Compiler state, TCCState upstream, tcc_state_t in the build shipped with examples/gdi_learn */
+#  ifndef CSFX_LIBTCC_STATE
+#  define CSFX_LIBTCC_STATE TCCState
+#  endif
+
+/* Handle of script compiled in memory, all of them are listed to tell them from handles of system loader */
+typedef struct csfx__tcc csfx__tcc_t;
+struct csfx__tcc
+{
+    csfx__tcc_t*       next;
+    CSFX_LIBTCC_STATE* state;
+    char*              image; /* Relocated code and data */
+    size_t             size;
+};
+
+static int csfx__tcc_owns(void* library);
+#  define csfx__library_symbol(l, n) (csfx__tcc_owns(l) ? tcc_get_symbol(((csfx__tcc_t*)(l))->state, n) : csfx__dlib_symbol(l, n))
+#else
+#  define csfx__tcc_owns(l)          0
+#  define csfx__library_symbol(l, n) csfx__dlib_symbol(l, n)
+#endif
+
 
 /** Custom helper functions **/
 #if defined(_WIN32)
@@ -421,7 +1219,19 @@ int csfx__seh_filter(csfx_script_t* script, unsigned long code)
         break;
     }
 
-    if (script) script->errcode = errcode;
+    if (script)
+    {
+        csfx__script_data_t* data = *(csfx__script_data_t**)(&script->internal);
+        
+        script->errcode = errcode;
+        if (data)
+        {
+            memset(&data->fault, 0, sizeof(data->fault));
+            data->fault.errcode = errcode;
+            data->faultmsg[0]   = 0;
+        }
+    }
+    
     if (errcode == CSFX_ERROR_NONE)
     {
         return EXCEPTION_CONTINUE_SEARCH;
@@ -432,6 +1242,110 @@ int csfx__seh_filter(csfx_script_t* script, unsigned long code)
     }
 }
 
+static void* csfx__vm_reserve(size_t size)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+static int csfx__vm_commit(void* ptr, size_t size)
+{
+    return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+static void csfx__vm_release(void* ptr, size_t size)
+{
+    (void)size;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+/* Watchdog is not supported on Windows, calls with budget are refused */
+static int csfx__timeout_arm(long budget_us)
+{
+    (void)budget_us;
+    return -1;
+}
+
+static void csfx__timeout_disarm(void)
+{
+    /* NULL */
+}
+
+/* SEH filter is scoped to __try already, no text ranges are needed */
+static void csfx__text_register(void* library)
+{
+    (void)library;
+}
+
+static void csfx__text_register_range(void* owner, char* lo, char* hi)
+{
+    (void)owner;
+    (void)lo;
+    (void)hi;
+}
+
+static void csfx__text_unregister(void* library)
+{
+    (void)library;
+}
+
+/* Globals are not transferred, PE files have no symbols of static data */
+static void* csfx__globals_save(void* library)
+{
+    (void)library;
+    return NULL;
+}
+
+static void csfx__globals_load(void* globals, void* library)
+{
+    (void)globals;
+    (void)library;
+}
+
+/* Stale pointers are not scanned, no symbols to rewrite them */
+static void* csfx__stale_collect(void* library, csfx_live_t* live, const csfx__region_t* regions, int count)
+{
+    (void)library;
+    (void)live;
+    (void)regions;
+    (void)count;
+    return NULL;
+}
+
+static int csfx__stale_apply(void* stale, void* library, char* report, int length)
+{
+    (void)stale;
+    (void)library;
+    if (length > 0) report[0] = 0;
+    return 0;
+}
+
+/* Functions are not patched, changed units relink the whole library */
+static int csfx__patch_resolve(void* library, void* patch, csfx__jump_t** jumps, int* count)
+{
+    (void)library;
+    (void)patch;
+    (void)jumps;
+    (void)count;
+    return -1;
+}
+
+static int csfx__patch_write(void* library, const csfx__jump_t* jumps, int count)
+{
+    (void)library;
+    (void)jumps;
+    return count > 0 ? -1 : 0;
+}
+
+void csfx_guard_begin(void)
+{
+    /* NULL */
+}
+
+void csfx_guard_end(void)
+{
+    /* NULL */
+}
+
 static int csfx__remove_file(const char* path);
 
 #if defined(_MSC_VER)
@@ -788,421 +1702,7514 @@ void csfx_quit(void)
 # endif /* _MSC_VER */
 
 #elif defined(__unix__)
+# if defined(__linux__) && (!defined(_GNU_SOURCE) || (defined(__GLIBC__) && !defined(__USE_GNU)))
+#  error "csfx: define _GNU_SOURCE before including any header in the CSFX_IMPL translation unit"
+# endif
+# include <limits.h>
 # include <string.h>
+# include <unistd.h>
+# include <sched.h>
+# include <pthread.h>
+# include <ucontext.h>
+# include <time.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
 # include <sys/stat.h>
 # include <sys/types.h>
+# include <sys/syscall.h>
+# include <link.h>
 # define CSFX__PATH_LENGTH PATH_MAX
 # define csfx__countof(x) (sizeof(x) / sizeof((x)[0]))
+# if defined(__GLIBC__)
+#  include <execinfo.h>
+#  define CSFX__BACKTRACE 1
+# endif
+# if defined(__GLIBC__) && !defined(sigev_notify_thread_id)
+#  define sigev_notify_thread_id _sigev_un._tid /* Named by glibc 2.35 and later only */
+# endif
+
+/* Size of alternate signal stack, handlers must run even the stack is overflowed */
+# ifndef CSFX_ALTSTACK_SIZE
+# define CSFX_ALTSTACK_SIZE (64 * 1024)
+# endif
+
+/* Signal raised by watchdog timer when a guarded call run out of budget */
+# ifndef CSFX_TIMEOUT_SIGNAL
+# define CSFX_TIMEOUT_SIGNAL (SIGRTMIN + 3)
+# endif
+
+/* Maximum number of loaded script versions with recorded text range */
+# ifndef CSFX_MAX_TEXT_RANGES
+# define CSFX_MAX_TEXT_RANGES 1024
+# endif
+
+/* Faults below the lowest stack page in this distance is stack overflow */
+# ifndef CSFX_STACK_GUARD_GAP
+# define CSFX_STACK_GUARD_GAP (1024 * 1024)
+# endif
+
+/* Per-thread guard state */
+/* Guard frame states */
+enum
+{
+    CSFX__FRAME_NEW,
+    CSFX__FRAME_ACTIVE,
+    CSFX__FRAME_DONE,
+};
+
+typedef struct
+{
+    int            ready;
+    int            guarded; /* Depth of csfx_guard_begin  */
+    csfx__frame_t* frames;  /* Innermost guard frame      */
+    void*  altstack;
+    size_t altsize;
+    char*  guardlo; /* Lowest address of guard region   */
+    char*  guardhi; /* Highest address of guard region  */
+    char*  stackhi; /* Highest address of stack         */
+
+    csfx_fault_t fault; /* Written by signal handler */
+
+    int          timerok;
+    timer_t      timer;
+    long long    deadline; /* Armed timer, monotonic nanoseconds, 0 when not armed */
+} csfx__thread_t;
+
+/* Mapped text of a loaded script version, read by signal handler.
+ * Guarded calls into it are counted, a patch is written only when none runs */
+typedef struct
+{
+    void* volatile owner;
+    char* volatile lo;
+    char* volatile hi;
+    volatile int   calls;
+    volatile int   patching;
+} csfx__text_t;
 
-__thread sigjmp_buf csfx__jmpenv;
 const int csfx__signals[] = { SIGBUS, SIGSYS, SIGILL, SIGSEGV, SIGABRT };
 
-static long csfx__last_modify_time(const char* path)
+static struct sigaction csfx__oldactions[csfx__countof(csfx__signals)];
+static struct sigaction csfx__oldtimeout;
+
+static csfx__text_t     csfx__texts[CSFX_MAX_TEXT_RANGES];
+static pthread_mutex_t  csfx__texts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread csfx__thread_t csfx__thread;
+static pthread_key_t           csfx__thread_key;
+static pthread_once_t          csfx__thread_once = PTHREAD_ONCE_INIT;
+
+static void csfx__thread_free(void* ptr)
 {
-    struct stat st;
-    if (stat(path, &st) != 0)
+    csfx__thread_t* thread = (csfx__thread_t*)ptr;
+    if (!thread || !thread->ready)
     {
-	return 0;
+        return;
     }
 
-    return (long)st.st_mtime;
-}
-
-static int csfx__copy_file(const char* from_path, const char* to_path)
-{
-    char scmd[3 * PATH_MAX]; /* 2 path and command */
-    sprintf(scmd, "\\cp -fR %s %s", from_path, to_path);
-    if (system(scmd) != 0)
+    if (thread->altstack)
     {
-	/* Has an error occur */
-	return 0;
+        stack_t ss;
+        ss.ss_sp    = NULL;
+        ss.ss_size  = 0;
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, NULL);
+	
+        munmap(thread->altstack, thread->altsize);
+        thread->altstack = NULL;
+        thread->altsize  = 0;
     }
-    else
+
+# if defined(__linux__)
+    if (thread->timerok)
     {
-	return 1;
+        timer_delete(thread->timer);
+        thread->timerok = 0;
     }
+# endif
+
+    thread->ready = 0;
 }
 
-static void csfx__sighandler(int code, siginfo_t* info, void* context)
+static void csfx__thread_key_create(void)
 {
-    int errcode;
+    pthread_key_create(&csfx__thread_key, csfx__thread_free);
+}
 
-    (void)info;
-    (void)context;
-    
-    switch (code)
+/* Alternate stack and guard range of calling thread, once per thread */
+static void csfx__thread_prepare(void)
+{
+    csfx__thread_t* thread = &csfx__thread;
+    if (thread->ready)
     {
-    case SIGILL:
-	errcode = CSFX_ERROR_ILLCODE;
-	break;
-
-    case SIGBUS:
-	errcode = CSFX_ERROR_MISALIGN;
-	break;
-
-    case SIGSYS:
-	errcode = CSFX_ERROR_SYSCALL;
-	break;
-
-    case SIGABRT:
-	errcode = CSFX_ERROR_ABORT;
-	break;
-
-    case SIGSEGV:
-	errcode = CSFX_ERROR_SEGFAULT;
-	break;
-	
-    default:
-	errcode = CSFX_ERROR_NONE;
-	break;
+        return;
     }
-    siglongjmp(csfx__jmpenv, errcode);
-}
 
+    pthread_once(&csfx__thread_once, csfx__thread_key_create);
 
-int  csfx_init(void)
+    /* Install alternate signal stack, keep the one of host if has */
+    stack_t ss;
+    if (sigaltstack(NULL, &ss) == 0 && (ss.ss_flags & SS_DISABLE))
+    {
+        size_t size  = CSFX_ALTSTACK_SIZE;
+        void*  stack = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (stack != MAP_FAILED)
+	{
+            ss.ss_sp    = stack;
+            ss.ss_size  = size;
+            ss.ss_flags = 0;
+            if (sigaltstack(&ss, NULL) == 0)
+            {
+                thread->altstack = stack;
+                thread->altsize  = size;
+            }
+            else
+            {
+                munmap(stack, size);
+            }
+	}
+    }
+
+    /* Find guard region, lower than the lowest address of the stack */
+    thread->guardlo = NULL;
+    thread->guardhi = NULL;
+    thread->stackhi = NULL;
+# if defined(__linux__)
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0)
+    {
+        void*  addr  = NULL;
+        size_t size  = 0;
+        size_t guard = 0;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+	{
+            pthread_attr_getguardsize(&attr, &guard);
+            
+            thread->guardlo = (char*)addr - guard - CSFX_STACK_GUARD_GAP;
+            thread->guardhi = (char*)addr + sysconf(_SC_PAGESIZE);
+            thread->stackhi = (char*)addr + size;
+	}
+        pthread_attr_destroy(&attr);
+    }
+# endif
+
+    thread->ready = 1;
+    pthread_setspecific(csfx__thread_key, thread);
+}
+
+/* @impl: csfx__frame_new */
+csfx__frame_t* csfx__frame_new(csfx__frame_t* frame, csfx_script_t* script)
+{
+    frame->state  = CSFX__FRAME_NEW;
+    frame->script = script;
+    frame->calls  = -1;
+    return frame;
+}
+
+/* Count a guarded call into library, waiting while a patch is written over it
+ * @return: slot of library, -1 when it has no text range */
+static int csfx__calls_enter(void* library)
+{
+    int idx;
+    for (idx = 0; library && idx < CSFX_MAX_TEXT_RANGES; idx++)
+    {
+        csfx__text_t* text = &csfx__texts[idx];
+        if (text->owner != library)
+        {
+            continue;
+        }
+
+        /* Full barriers: the patcher sees this call, or this call sees the patcher */
+        for (;;)
+        {
+            __sync_fetch_and_add(&text->calls, 1);
+            if (!text->patching)
+            {
+                return idx;
+            }
+            __sync_fetch_and_sub(&text->calls, 1);
+            while (text->patching)
+            {
+                sched_yield();
+            }
+        }
+    }
+    return -1;
+}
+
+/* @impl: csfx__frame_enter */
+int csfx__frame_enter(csfx__frame_t* frame)
+{
+    if (frame->state != CSFX__FRAME_NEW)
+    {
+	return 0;
+    }
+
+    csfx__thread_prepare();
+    csfx__thread_t* thread = &csfx__thread;
+
+    /* Frames deeper than the new one are left by return or break, drop them */
+    csfx__frame_t* top = thread->frames;
+    while (top && (char*)top < (char*)frame)
+    {
+        top = top->prev;
+    }
+
+    frame->prev     = top;
+    frame->state    = CSFX__FRAME_ACTIVE;
+    frame->errcode  = CSFX_ERROR_NONE;
+    frame->deadline = 0;
+    thread->frames  = frame;
+
+    csfx__script_data_t* data = frame->script ? *(csfx__script_data_t**)(&frame->script->internal) : NULL;
+    frame->calls = data ? csfx__calls_enter(data->library) : -1;
+    return 1;
+}
+
+/* @impl: csfx__frame_leave */
+void csfx__frame_leave(csfx__frame_t* frame, csfx_script_t* script)
+{
+    if (frame->state == CSFX__FRAME_ACTIVE)
+    {
+        csfx__thread.frames = frame->prev;
+    }
+    frame->state = CSFX__FRAME_DONE;
+
+    /* Left after a fault too, the frame was popped by the handler but the call ended */
+    if (frame->calls >= 0)
+    {
+        __sync_fetch_and_sub(&csfx__texts[frame->calls].calls, 1);
+        frame->calls = -1;
+    }
+
+    if (script)
+    {
+        script->errcode = frame->errcode;
+    }
+}
+
+/* Pop the innermost frame that is still alive on the faulting stack */
+static csfx__frame_t* csfx__frame_pop(const void* sp)
+{
+    csfx__thread_t* thread = &csfx__thread;
+    csfx__frame_t*  frame  = thread->frames;
+    while (frame && sp && (const char*)frame < (const char*)sp)
+    {
+        frame = frame->prev;
+    }
+
+    if (frame)
+    {
+        thread->frames = frame->prev;
+        frame->state   = CSFX__FRAME_DONE;
+    }
+    else
+    {
+        thread->frames = NULL;
+    }
+    return frame;
+}
+
+void csfx_guard_begin(void)
+{
+    csfx__thread.guarded++;
+}
+
+void csfx_guard_end(void)
+{
+    if (csfx__thread.guarded > 0)
+    {
+        csfx__thread.guarded--;
+    }
+}
+
+typedef struct
+{
+    void*        owner;
+    ElfW(Addr)   base;
+    const char*  name;
+    csfx__text_t text;
+} csfx__text_query_t;
+
+/* Find the lowest and highest address of executable segments of an object */
+static int csfx__text_phdr_callback(struct dl_phdr_info* info, size_t size, void* userdata)
+{
+    csfx__text_query_t* query = (csfx__text_query_t*)userdata;
+
+    (void)size;
+    if (query->owner && (info->dlpi_addr != query->base || strcmp(info->dlpi_name, query->name) != 0))
+    {
+	return 0;
+    }
+
+    int idx;
+    for (idx = 0; idx < info->dlpi_phnum; idx++)
+    {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[idx];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X))
+        {
+            char* lo = (char*)(info->dlpi_addr + phdr->p_vaddr);
+            char* hi = lo + phdr->p_memsz;
+            if (!query->text.lo || lo < query->text.lo) query->text.lo = lo;
+            if (!query->text.hi || hi > query->text.hi) query->text.hi = hi;
+        }
+    }
+
+    /* The first object is the host executable */
+    return 1;
+}
+
+static void csfx__text_register_range(void* owner, char* lo, char* hi)
+{
+    pthread_mutex_lock(&csfx__texts_lock);
+    int idx;
+    for (idx = 0; idx < CSFX_MAX_TEXT_RANGES; idx++)
+    {
+        csfx__text_t* text = &csfx__texts[idx];
+        if (!text->owner)
+        {
+            text->lo       = lo;
+            text->hi       = hi;
+            text->calls    = 0;
+            text->patching = 0;
+            __sync_synchronize();
+            text->owner = owner;
+	    break;
+        }
+    }
+    pthread_mutex_unlock(&csfx__texts_lock);
+}
+
+static void csfx__text_register(void* library)
+{
+    struct link_map* map = NULL;
+    if (dlinfo(library, RTLD_DI_LINKMAP, &map) != 0 || !map)
+    {
+        return;
+    }
+
+    csfx__text_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.owner = library;
+    query.base  = map->l_addr;
+    query.name  = map->l_name;
+    dl_iterate_phdr(csfx__text_phdr_callback, &query);
+    if (query.text.lo)
+    {
+        csfx__text_register_range(library, query.text.lo, query.text.hi);
+    }
+}
+
+static void csfx__text_unregister(void* library)
+{
+    pthread_mutex_lock(&csfx__texts_lock);
+    int idx;
+    for (idx = 0; idx < CSFX_MAX_TEXT_RANGES; idx++)
+    {
+        csfx__text_t* text = &csfx__texts[idx];
+        if (text->owner == library)
+        {
+            text->owner = NULL;
+            __sync_synchronize();
+            text->lo = NULL;
+            text->hi = NULL;
+        }
+    }
+    pthread_mutex_unlock(&csfx__texts_lock);
+}
+
+/** Globals transfer: writable objects of ELF symbol table, by name and size **/
+
+typedef struct
+{
+    const char* name;
+    size_t      size;
+    void*       addr; /* Address in loaded library, or offset into saved data */
+} csfx__global_t;
+
+typedef struct
+{
+    int             count;
+    csfx__global_t* items;
+    char*           strings;
+    char*           values;
+    const char*     imagelo; /* Mapped image of library */
+    const char*     imagehi;
+} csfx__globals_t;
+
+static int csfx__global_compare(const void* a, const void* b)
+{
+    const csfx__global_t* ga = (const csfx__global_t*)a;
+    const csfx__global_t* gb = (const csfx__global_t*)b;
+    return strcmp(ga->name, gb->name);
+}
+
+/* Globals of C++ libraries carried across reloads, opted in with CSFX_PERSIST */
+static int csfx__global_persist(const char* name)
+{
+    return strcmp(name, "csfx_persist") == 0;
+}
+
+/* Libraries with C++ symbols or destructors of globals: objects of them must not be copied */
+static int csfx__global_cxx(const char* name)
+{
+    return strncmp(name, "_Z", 2) == 0 || strcmp(name, "__cxa_atexit") == 0;
+}
+
+/* Writable data of script, excluding relro and TLS sections */
+static int csfx__global_section(const char* name)
+{
+    if (strncmp(name, ".data", 5) != 0 && strncmp(name, ".bss", 4) != 0)
+    {
+        return 0; /* Other sections, csfx_persist and csfx_transient too */
+    }
+    return strncmp(name, ".data.rel.ro", 12) != 0;
+}
+
+/* Skip objects of runtime and csfx itself, and guards of C++ statics */
+static int csfx__global_skip(const char* name)
+{
+    return name[0] == '\0'
+        || strncmp(name, "__", 2) == 0
+        || strncmp(name, "_ZGV", 4) == 0
+        || strncmp(name, "completed.", 10) == 0
+        || strcmp(name, "csfx_arena") == 0;
+}
+
+/* Map file of loaded library to read its tables, NULL when it is not a valid ELF file */
+static const char* csfx__elf_map(void* library, struct link_map** map, size_t* size)
+{
+    /* Code compiled in memory has no symbol table to read */
+    *map = NULL;
+    if (csfx__tcc_owns(library) || dlinfo(library, RTLD_DI_LINKMAP, map) != 0 || !*map || !(*map)->l_name)
+    {
+        return NULL;
+    }
+
+    int fd = open((*map)->l_name, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    void* file = fstat(fd, &st) == 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const ElfW(Ehdr)* ehdr = (const ElfW(Ehdr)*)file;
+    if ((size_t)st.st_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+        || (size_t)ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > (size_t)st.st_size
+        || (size_t)ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(ElfW(Phdr)) > (size_t)st.st_size
+        || ehdr->e_shstrndx >= ehdr->e_shnum)
+    {
+        munmap(file, st.st_size);
+        return NULL;
+    }
+
+    /* Contents of every section lie in file, so tables are read without other checks */
+    const ElfW(Shdr)* shdrs = (const ElfW(Shdr)*)((const char*)file + ehdr->e_shoff);
+    int idx;
+    for (idx = 0; idx < ehdr->e_shnum; idx++)
+    {
+        if (shdrs[idx].sh_type != SHT_NOBITS
+            && (shdrs[idx].sh_offset > (size_t)st.st_size || shdrs[idx].sh_size > (size_t)st.st_size - shdrs[idx].sh_offset))
+        {
+            munmap(file, st.st_size);
+            return NULL;
+        }
+    }
+
+    *size = (size_t)st.st_size;
+    return (const char*)file;
+}
+
+/* Name at offset of string table, NULL when out of it */
+static const char* csfx__elf_string(const char* image, const ElfW(Shdr)* strtab, size_t offset)
+{
+    if (strtab->sh_type != SHT_STRTAB || strtab->sh_size == 0 || offset >= strtab->sh_size
+        || image[strtab->sh_offset + strtab->sh_size - 1] != '\0')
+    {
+        return NULL;
+    }
+    return image + strtab->sh_offset + offset;
+}
+
+/* Full symbol table has static objects, dynamic one only exported */
+static const ElfW(Shdr)* csfx__elf_symtab(const char* image)
+{
+    const ElfW(Ehdr)* ehdr   = (const ElfW(Ehdr)*)image;
+    const ElfW(Shdr)* shdrs  = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+    const ElfW(Shdr)* symtab = NULL;
+    int idx;
+    for (idx = 0; idx < ehdr->e_shnum; idx++)
+    {
+        if ((shdrs[idx].sh_type == SHT_SYMTAB || (!symtab && shdrs[idx].sh_type == SHT_DYNSYM))
+            && shdrs[idx].sh_link < ehdr->e_shnum && shdrs[shdrs[idx].sh_link].sh_type == SHT_STRTAB)
+        {
+            symtab = &shdrs[idx];
+        }
+    }
+    return symtab;
+}
+
+/* Defined symbol of image by name, NULL when not found. Read from file, so it needs no dladdr1 */
+static const ElfW(Sym)* csfx__elf_lookup(const char* image, const char* name)
+{
+    const ElfW(Ehdr)* ehdr   = (const ElfW(Ehdr)*)image;
+    const ElfW(Shdr)* shdrs  = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+    const ElfW(Shdr)* symtab = csfx__elf_symtab(image);
+    const ElfW(Sym)*  syms   = symtab ? (const ElfW(Sym)*)(image + symtab->sh_offset) : NULL;
+    size_t            nsyms  = symtab ? symtab->sh_size / sizeof(ElfW(Sym)) : 0;
+
+    size_t idx;
+    for (idx = 0; idx < nsyms; idx++)
+    {
+        const char* symname = csfx__elf_string(image, &shdrs[symtab->sh_link], syms[idx].st_name);
+        if (symname && syms[idx].st_shndx != SHN_UNDEF && strcmp(symname, name) == 0)
+        {
+            return &syms[idx];
+        }
+    }
+    return NULL;
+}
+
+/* Collect globals of library, sorted by name, duplicated names are dropped */
+static int csfx__globals_collect(void* library, csfx__globals_t* out)
+{
+    memset(out, 0, sizeof(*out));
+
+    struct link_map* map;
+    size_t           size;
+    const char*      image = csfx__elf_map(library, &map, &size);
+    if (!image)
+    {
+        return -1;
+    }
+
+    const ElfW(Ehdr)* ehdr = (const ElfW(Ehdr)*)image;
+
+    /* Pointers into the image dangle after unload, find its range */
+    const ElfW(Phdr)* phdrs = (const ElfW(Phdr)*)(image + ehdr->e_phoff);
+    int idx;
+    for (idx = 0; idx < ehdr->e_phnum; idx++)
+    {
+        if (phdrs[idx].p_type == PT_LOAD)
+        {
+            const char* lo = (const char*)(map->l_addr + phdrs[idx].p_vaddr);
+            const char* hi = lo + phdrs[idx].p_memsz;
+            out->imagelo = !out->imagelo || lo < out->imagelo ? lo : out->imagelo;
+            out->imagehi = hi > out->imagehi ? hi : out->imagehi;
+        }
+    }
+
+    const ElfW(Shdr)* shdrs  = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+    const ElfW(Shdr)* symtab = csfx__elf_symtab(image);
+    const ElfW(Shdr)* shstrs = &shdrs[ehdr->e_shstrndx];
+    if (symtab)
+    {
+        const ElfW(Sym)*  syms  = (const ElfW(Sym)*)(image + symtab->sh_offset);
+        const ElfW(Shdr)* strs  = &shdrs[symtab->sh_link];
+        int               nsyms = (int)(symtab->sh_size / sizeof(ElfW(Sym)));
+        size_t            bytes = 0;
+        int               cxx   = 0;
+
+        /* Plain C carries all writable data but CSFX_TRANSIENT, C++ only CSFX_PERSIST */
+        for (idx = 0; !cxx && idx < nsyms; idx++)
+        {
+            const char* name = csfx__elf_string(image, strs, syms[idx].st_name);
+            cxx = name && csfx__global_cxx(name);
+        }
+
+        out->items = (csfx__global_t*)malloc(sizeof(csfx__global_t) * (nsyms > 0 ? nsyms : 1));
+        for (idx = 0; out->items && idx < nsyms; idx++)
+        {
+            const ElfW(Sym)* sym = &syms[idx];
+            if (ELF32_ST_TYPE(sym->st_info) != STT_OBJECT || sym->st_size == 0
+                || sym->st_shndx == SHN_UNDEF || sym->st_shndx >= ehdr->e_shnum)
+            {
+                continue;
+            }
+
+            const ElfW(Shdr)* shdr    = &shdrs[sym->st_shndx];
+            const char*       section = csfx__elf_string(image, shstrs, shdr->sh_name);
+            const char*       name    = csfx__elf_string(image, strs, sym->st_name);
+            if (!(shdr->sh_flags & SHF_ALLOC) || !(shdr->sh_flags & SHF_WRITE) || !section
+                || !(csfx__global_persist(section) || (!cxx && csfx__global_section(section)))
+                || !name || csfx__global_skip(name))
+            {
+                continue;
+            }
+
+            csfx__global_t* item = &out->items[out->count++];
+            item->name = name;
+            item->size = sym->st_size;
+            item->addr = (void*)(map->l_addr + sym->st_value);
+            bytes += strlen(item->name) + 1;
+        }
+
+        /* Objects constructed on first use have a guard, the new version must construct its own */
+        for (idx = 0; out->items && idx < nsyms; idx++)
+        {
+            const char* guard = csfx__elf_string(image, strs, syms[idx].st_name);
+            int         other;
+            for (other = 0; guard && strncmp(guard, "_ZGV", 4) == 0 && other < out->count; other++)
+            {
+                const char* name = out->items[other].name;
+                if (strncmp(name, "_Z", 2) == 0 && strcmp(name + 2, guard + 4) == 0)
+                {
+                    out->items[other--] = out->items[--out->count];
+                }
+            }
+        }
+
+        /* Names must outlive the mapping of file */
+        out->strings = (char*)malloc(bytes + 1);
+        for (idx = 0, bytes = 0; out->strings && idx < out->count; idx++)
+        {
+            size_t len = strlen(out->items[idx].name) + 1;
+            out->items[idx].name = (const char*)memcpy(out->strings + bytes, out->items[idx].name, len);
+            bytes += len;
+        }
+    }
+    munmap((void*)image, size);
+
+    if (!out->items || !out->strings)
+    {
+        free(out->items);
+        free(out->strings);
+        memset(out, 0, sizeof(*out));
+        return -1;
+    }
+
+    /* Static objects of different units can share a name, they cannot be matched */
+    qsort(out->items, out->count, sizeof(csfx__global_t), csfx__global_compare);
+    int count = 0;
+    for (idx = 0; idx < out->count; idx++)
+    {
+        int dup = (idx > 0 && strcmp(out->items[idx - 1].name, out->items[idx].name) == 0)
+            || (idx + 1 < out->count && strcmp(out->items[idx + 1].name, out->items[idx].name) == 0);
+        if (!dup)
+        {
+            out->items[count++] = out->items[idx];
+        }
+    }
+    out->count = count;
+    return 0;
+}
+
+static void csfx__globals_free(csfx__globals_t* globals)
+{
+    if (globals)
+    {
+        free(globals->items);
+        free(globals->strings);
+        free(globals->values);
+        free(globals);
+    }
+}
+
+/* Object hold a pointer into [lo, hi), e.g. string literal or function of script */
+static int csfx__global_refers(const csfx__global_t* item, const char* lo, const char* hi)
+{
+    const char* ptr = (const char*)item->addr;
+    const char* end = ptr + item->size;
+    
+    ptr += (sizeof(void*) - (size_t)ptr % sizeof(void*)) % sizeof(void*);
+    for (; ptr + sizeof(void*) <= end; ptr += sizeof(void*))
+    {
+        const char* value = *(const char* const*)ptr;
+        if (value >= lo && value < hi)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Save values of globals, library must still be loaded */
+static void* csfx__globals_save(void* library)
+{
+    csfx__globals_t* globals = (csfx__globals_t*)malloc(sizeof(csfx__globals_t));
+    if (!globals || csfx__globals_collect(library, globals) != 0)
+    {
+        free(globals);
+        return NULL;
+    }
+
+    size_t bytes = 0;
+    int    idx;
+    for (idx = 0; idx < globals->count; idx++)
+    {
+        bytes += globals->items[idx].size;
+    }
+
+    globals->values = (char*)malloc(bytes + 1);
+    if (!globals->values)
+    {
+        csfx__globals_free(globals);
+        return NULL;
+    }
+
+    int count = 0;
+    for (idx = 0, bytes = 0; idx < globals->count; idx++)
+    {
+        csfx__global_t* item = &globals->items[idx];
+        if (csfx__global_refers(item, globals->imagelo, globals->imagehi))
+        {
+            continue; /* Keep initial value of new version */
+        }
+	
+        memcpy(globals->values + bytes, item->addr, item->size);
+        item->addr = globals->values + bytes;
+        bytes += item->size;
+        globals->items[count++] = *item;
+    }
+    globals->count = count;
+    return globals;
+}
+
+/* Copy saved values into globals of library with same name and size, then free them.
+ * NULL library only free saved values */
+static void csfx__globals_load(void* saved, void* library)
+{
+    csfx__globals_t* globals = (csfx__globals_t*)saved;
+    csfx__globals_t  current;
+    if (!globals || !library || csfx__globals_collect(library, &current) != 0)
+    {
+        csfx__globals_free(globals);
+        return;
+    }
+
+    int idx;
+    for (idx = 0; idx < current.count; idx++)
+    {
+        const csfx__global_t* item = &current.items[idx];
+        const csfx__global_t* from = (const csfx__global_t*)bsearch(item, globals->items, globals->count,
+                                                                      sizeof(csfx__global_t), csfx__global_compare);
+        if (from && from->size == item->size)
+        {
+            memcpy(item->addr, from->addr, item->size);
+        }
+    }
+
+    free(current.items);
+    free(current.strings);
+    csfx__globals_free(globals);
+}
+
+/** Stale pointers: words of state point into the image of unloaded library **/
+
+typedef struct
+{
+    void**      where;
+    void*       value;
+    char*       name;   /* Symbol of value, NULL when unresolved */
+    size_t      offset; /* Offset of value from symbol           */
+} csfx__stale_t;
+
+typedef struct
+{
+    int            count;
+    int            capacity;
+    int            live;  /* First items are vtable pointers of live objects */
+    csfx__stale_t* items;
+} csfx__stales_t;
+
+static csfx__stale_t* csfx__stale_push(csfx__stales_t* stales)
+{
+    if (stales->count >= stales->capacity)
+    {
+        int            capacity = stales->capacity ? stales->capacity * 2 : 64;
+        csfx__stale_t* items    = (csfx__stale_t*)realloc(stales->items, sizeof(csfx__stale_t) * capacity);
+        if (!items)
+        {
+            return NULL;
+        }
+        stales->items    = items;
+        stales->capacity = capacity;
+    }
+    return &stales->items[stales->count++];
+}
+
+/* Range of loaded segments of library */
+static int csfx__image_phdr_callback(struct dl_phdr_info* info, size_t size, void* userdata)
+{
+    (void)size;
+
+    csfx__globals_t* image = (csfx__globals_t*)userdata;
+    if (info->dlpi_addr != (ElfW(Addr))image->imagelo)
+    {
+        return 0;
+    }
+
+    image->imagelo = NULL;
+    int idx;
+    for (idx = 0; idx < info->dlpi_phnum; idx++)
+    {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[idx];
+        if (phdr->p_type == PT_LOAD)
+        {
+            const char* lo = (const char*)(info->dlpi_addr + phdr->p_vaddr);
+            const char* hi = lo + phdr->p_memsz;
+            image->imagelo = !image->imagelo || lo < image->imagelo ? lo : image->imagelo;
+            image->imagehi = hi > image->imagehi ? hi : image->imagehi;
+        }
+    }
+    return 1;
+}
+
+/* Vtable pointers of live objects are already collected */
+static int csfx__stale_known(const csfx__stales_t* stales, void** where)
+{
+    int idx;
+    for (idx = 0; idx < stales->live; idx++)
+    {
+        if (stales->items[idx].where == where)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void csfx__stale_scan(csfx__stales_t* stales, const csfx__region_t* region, const char* lo, const char* hi)
+{
+    char* ptr = region->ptr;
+    char* end = region->ptr + region->size;
+    
+    ptr += (sizeof(void*) - (size_t)ptr % sizeof(void*)) % sizeof(void*);
+    for (; ptr + sizeof(void*) <= end; ptr += sizeof(void*))
+    {
+        void* value = *(void**)ptr;
+        if ((const char*)value < lo || (const char*)value >= hi || csfx__stale_known(stales, (void**)ptr))
+        {
+            continue;
+        }
+
+        /* Symbol must cover the value, string literals and static functions have none */
+        csfx__stale_t* stale = csfx__stale_push(stales);
+        if (!stale)
+        {
+            return;
+        }
+        stale->where  = (void**)ptr;
+        stale->value  = value;
+        stale->name   = NULL;
+        stale->offset = 0;
+
+        Dl_info info;
+        memset(&info, 0, sizeof(info));
+# if defined(__GLIBC__)
+        const ElfW(Sym)* sym = NULL;
+        if (dladdr1(value, &info, (void**)&sym, RTLD_DL_SYMENT) && info.dli_sname && sym)
+        {
+            size_t offset = (size_t)((char*)value - (char*)info.dli_saddr);
+            if (offset == 0 || offset < sym->st_size)
+            {
+                stale->name   = strdup(info.dli_sname);
+                stale->offset = offset;
+            }
+        }
+# else
+        if (dladdr(value, &info) && info.dli_sname && info.dli_saddr == value)
+        {
+            stale->name = strdup(info.dli_sname);
+        }
+# endif
+    }
+}
+
+/* Vtable pointers of live objects, as offsets into vtable of their type.
+ * Size of a vtable comes from the symbol table of library file, mapped at image */
+static void csfx__live_vtables(csfx__stales_t* stales, void* library, csfx_live_t* live,
+                               const char* image, const struct link_map* map)
+{
+    const char* vtable = NULL;
+    size_t      vtsize = 0;
+    const char* type   = NULL;
+    char        name[512];
+    
+    for (; live; live = live->next)
+    {
+        /* Objects of same type are usually together */
+        if (!type || strcmp(type, live->type) != 0)
+        {
+            type   = live->type;
+            snprintf(name, sizeof(name), "_ZTV%s", type);
+            vtable = (const char*)csfx__library_symbol(library, name);
+
+            const ElfW(Sym)* sym = vtable ? csfx__elf_lookup(image, name) : NULL;
+            vtsize = sym && (const char*)(map->l_addr + sym->st_value) == vtable ? sym->st_size : 0;
+        }
+
+        char* ptr = (char*)live->object;
+        char* end = ptr + live->size;
+        for (; ptr + sizeof(void*) <= end; ptr += sizeof(void*))
+        {
+            const char* value = *(const char**)ptr;
+            if (!vtable || value < vtable || value >= vtable + vtsize)
+            {
+                continue;
+            }
+
+            csfx__stale_t* stale = csfx__stale_push(stales);
+            if (!stale)
+            {
+                return;
+            }
+            stale->where  = (void**)ptr;
+            stale->value  = (void*)value;
+            stale->name   = strdup(name);
+            stale->offset = (size_t)(value - vtable);
+        }
+    }
+}
+
+static void csfx__live_collect(csfx__stales_t* stales, void* library, csfx_live_t* live)
+{
+    struct link_map* map;
+    size_t           size;
+    const char*      image = live ? csfx__elf_map(library, &map, &size) : NULL;
+    if (image)
+    {
+        csfx__live_vtables(stales, library, live, image, map);
+        munmap((void*)image, size);
+    }
+}
+
+/* Find stale pointers in live objects, regions and arena before library is unloaded */
+static void* csfx__stale_collect(void* library, csfx_live_t* live, const csfx__region_t* regions, int count)
+{
+    struct link_map* map = NULL;
+    if (csfx__tcc_owns(library) || dlinfo(library, RTLD_DI_LINKMAP, &map) != 0 || !map)
+    {
+        return NULL;
+    }
+
+    csfx__globals_t image;
+    memset(&image, 0, sizeof(image));
+    image.imagelo = (const char*)map->l_addr;
+    if (!dl_iterate_phdr(csfx__image_phdr_callback, &image) || !image.imagelo)
+    {
+        return NULL;
+    }
+
+    csfx__stales_t* stales = (csfx__stales_t*)calloc(1, sizeof(csfx__stales_t));
+    if (stales)
+    {
+        csfx__live_collect(stales, library, live);
+        stales->live = stales->count;
+    }
+
+    int idx;
+    for (idx = 0; stales && idx < count; idx++)
+    {
+        csfx__stale_scan(stales, &regions[idx], image.imagelo, image.imagehi);
+    }
+    return stales;
+}
+
+/* Rewrite stale pointers to same symbols of new library, report the rest, then free them.
+ * NULL library only free them. Return number of pointers left */
+static int csfx__stale_apply(void* saved, void* library, char* report, int length)
+{
+    csfx__stales_t* stales = (csfx__stales_t*)saved;
+    int             left   = 0;
+    int             len    = 0;
+    if (length > 0)
+    {
+        report[0] = 0;
+    }
+
+    int idx;
+    for (idx = 0; stales && idx < stales->count; idx++)
+    {
+        csfx__stale_t* stale = &stales->items[idx];
+        char*          addr  = library && stale->name ? (char*)csfx__library_symbol(library, stale->name) : NULL;
+        if (addr)
+        {
+            *stale->where = addr + stale->offset;
+        }
+        else if (library)
+        {
+            left++;
+            if (len >= 0 && len < length)
+            {
+                len += snprintf(report + len, length - len, "stale pointer %p at %p: %s+0x%lx\n",
+                                stale->value, (void*)stale->where,
+                                stale->name ? stale->name : "??", (unsigned long)stale->offset);
+            }
+        }
+        free(stale->name);
+    }
+
+    if (stales)
+    {
+        free(stales->items);
+        free(stales);
+    }
+    return left;
+}
+
+/** Patches: exported functions of loaded library jump to their version in a patch library **/
+
+#if defined(__x86_64__)
+#define CSFX__PATCH_JUMP 14 /* jmp [rip], then the address */
+#elif defined(__aarch64__)
+#define CSFX__PATCH_JUMP 16 /* ldr x16, #8; br x16, then the address */
+#endif
+
+#if defined(CSFX__PATCH_JUMP)
+static void csfx__patch_jump(char* from, const char* to)
+{
+#if defined(__x86_64__)
+    static const unsigned char code[6] = { 0xff, 0x25, 0x00, 0x00, 0x00, 0x00 };
+#else
+    static const unsigned int  code[2] = { 0x58000050, 0xd61f0200 };
+#endif
+    memcpy(from, code, sizeof(code));
+    memcpy(from + sizeof(code), &to, sizeof(to));
+    __builtin___clear_cache(from, from + CSFX__PATCH_JUMP);
+}
+
+static int csfx__patch_protect(char* from, int prot)
+{
+    size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    char*  page     = (char*)((size_t)from & ~(pagesize - 1));
+    return mprotect(page, (size_t)(from + CSFX__PATCH_JUMP - page), prot);
+}
+#endif
+
+/* Hold new guarded calls into library, while its entries are written
+ * @return: slot to release, -1 when library has no text range, -2 when a call runs */
+static int csfx__calls_block(void* library)
+{
+    int idx;
+    for (idx = 0; idx < CSFX_MAX_TEXT_RANGES; idx++)
+    {
+        csfx__text_t* text = &csfx__texts[idx];
+        if (text->owner == library)
+        {
+            __sync_lock_test_and_set(&text->patching, 1);
+            __sync_synchronize();
+            if (text->calls > 0)
+            {
+                __sync_lock_release(&text->patching);
+                return -2;
+            }
+            return idx;
+        }
+    }
+    return -1;
+}
+
+/* Append jumps from functions of library to the ones patch define. Patch must not define data:
+ * other functions of library would keep using old copies. Resolved while both files are readable,
+ * the patch file is removed once loaded
+ * @return: 0 when it can apply, -1 when library must be reloaded whole, then jumps are left as they were */
+static int csfx__patch_resolve(void* library, void* patch, csfx__jump_t** jumps, int* count)
+{
+#if defined(CSFX__PATCH_JUMP)
+    struct link_map* base;
+    struct link_map* map;
+    size_t           libsize;
+    size_t           size;
+    const char*      libimage = csfx__elf_map(library, &base, &libsize);
+    const char*      image    = libimage ? csfx__elf_map(patch, &map, &size) : NULL;
+    if (!image)
+    {
+        if (libimage) munmap((void*)libimage, libsize);
+        return -1;
+    }
+
+    const ElfW(Ehdr)* ehdr   = (const ElfW(Ehdr)*)image;
+    const ElfW(Shdr)* shdrs  = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+    const ElfW(Shdr)* symtab = csfx__elf_symtab(image);
+    const ElfW(Shdr)* shstrs = &shdrs[ehdr->e_shstrndx];
+    int               nsyms  = symtab ? (int)(symtab->sh_size / sizeof(ElfW(Sym))) : 0;
+    csfx__jump_t*     list   = (csfx__jump_t*)realloc(*jumps, sizeof(csfx__jump_t) * (*count + (nsyms > 0 ? nsyms : 1)));
+    int               added  = *count;
+    int               result = symtab && list ? 0 : -1;
+    *jumps = list ? list : *jumps;
+
+    int idx;
+    for (idx = 0; result == 0 && idx < nsyms; idx++)
+    {
+        const ElfW(Sym)* sym  = &((const ElfW(Sym)*)(image + symtab->sh_offset))[idx];
+        const char*      name = csfx__elf_string(image, &shdrs[symtab->sh_link], sym->st_name);
+        int              type = ELF32_ST_TYPE(sym->st_info);
+        if (!name || sym->st_shndx == SHN_UNDEF || sym->st_shndx >= ehdr->e_shnum)
+        {
+            continue;
+        }
+
+        const ElfW(Shdr)* shdr    = &shdrs[sym->st_shndx];
+        const char*       section = csfx__elf_string(image, shstrs, shdr->sh_name);
+        if (type == STT_TLS || (type == STT_OBJECT && strncmp(name, "csfx_", 5) == 0)
+            || (type == STT_OBJECT && (shdr->sh_flags & SHF_ALLOC) && (shdr->sh_flags & SHF_WRITE)
+                && (!section || csfx__global_section(section) || csfx__global_persist(section)
+                    || strcmp(section, "csfx_transient") == 0)
+                && !csfx__global_skip(name)))
+        {
+            result = -1; /* Data or layout changed, reload whole library */
+            break;
+        }
+
+        if (type != STT_FUNC || ELF32_ST_BIND(sym->st_info) == STB_LOCAL || sym->st_size == 0)
+        {
+            continue;
+        }
+
+        /* New functions have no callers in library, functions too short for a jump cannot be patched */
+        const ElfW(Sym)* old  = csfx__elf_lookup(libimage, name);
+        char*            from = (char*)dlsym(library, name);
+        if (!from || !old || ELF32_ST_TYPE(old->st_info) != STT_FUNC || from != (char*)(base->l_addr + old->st_value))
+        {
+            continue;
+        }
+
+        if (old->st_size < CSFX__PATCH_JUMP)
+        {
+            result = -1;
+            break;
+        }
+
+        list[added].from = from;
+        list[added].to   = (const char*)(map->l_addr + sym->st_value);
+        added++;
+    }
+    munmap((void*)image, size);
+    munmap((void*)libimage, libsize);
+
+    if (result == 0)
+    {
+        *count = added;
+    }
+    return result;
+#else
+    (void)library;
+    (void)patch;
+    (void)jumps;
+    (void)count;
+    return -1;
+#endif
+}
+
+/* Write jumps over entries of library, only when no guarded call runs in it: another thread
+ * could fetch a half written jump. Nothing is written on failure
+ * @return: 0 when written, 1 when a guarded call runs, -1 when entries cannot be made writable */
+static int csfx__patch_write(void* library, const csfx__jump_t* jumps, int count)
+{
+#if defined(CSFX__PATCH_JUMP)
+    int slot = count > 0 ? csfx__calls_block(library) : -1;
+    if (slot == -2)
+    {
+        return 1;
+    }
+
+    /* Make all entries writable first, a half patched library is worse than a reload */
+    int idx;
+    int result = 0;
+    int writable;
+    for (writable = 0; result == 0 && writable < count; writable++)
+    {
+        if (csfx__patch_protect(jumps[writable].from, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+        {
+            result = -1;
+            break;
+        }
+    }
+
+    for (idx = 0; result == 0 && idx < count; idx++)
+    {
+        csfx__patch_jump(jumps[idx].from, jumps[idx].to);
+    }
+
+    for (idx = 0; idx < writable; idx++)
+    {
+        csfx__patch_protect(jumps[idx].from, PROT_READ | PROT_EXEC);
+    }
+
+    if (slot >= 0)
+    {
+        __sync_lock_release(&csfx__texts[slot].patching);
+    }
+    return result;
+#else
+    (void)library;
+    (void)jumps;
+    return count > 0 ? -1 : 0;
+#endif
+}
+
+static int csfx__text_contains(const csfx__text_t* text, const void* addr)
+{
+    const char* ptr = (const char*)addr;
+    return ptr >= text->lo && ptr < text->hi;
+}
+
+static int csfx__is_script_text(const void* addr)
+{
+    int idx;
+    for (idx = 0; idx < CSFX_MAX_TEXT_RANGES; idx++)
+    {
+        const csfx__text_t* text = &csfx__texts[idx];
+        if (text->owner && csfx__text_contains(text, addr))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Faulting pc decide, no unwinding in the handler: only script text is owned.
+ * A leaf function called by script, like memcpy, is owned by its return address
+ */
+static int csfx__fault_owned(const csfx_fault_t* fault, const void* ra)
+{
+    const csfx__thread_t* thread = &csfx__thread;
+    return thread->guarded > 0 || csfx__is_script_text(fault->pc) || (ra && csfx__is_script_text(ra));
+}
+
+/* Forward a fault that csfx does not own to the handler installed before csfx_init */
+static void csfx__sigchain(int code, siginfo_t* info, void* context)
+{
+    const struct sigaction* old = NULL;
+
+    int idx;
+    for (idx = 0; idx < (int)csfx__countof(csfx__signals); idx++)
+    {
+        if (csfx__signals[idx] == code)
+        {
+            old = &csfx__oldactions[idx];
+            break;
+        }
+    }
+
+    if (old && (old->sa_flags & SA_SIGINFO))
+    {
+        if (old->sa_sigaction)
+        {
+            old->sa_sigaction(code, info, context);
+        }
+    }
+    else if (old && old->sa_handler == SIG_IGN)
+    {
+        /* NULL */
+    }
+    else if (old && old->sa_handler != SIG_DFL && old->sa_handler)
+    {
+        old->sa_handler(code);
+    }
+    else
+    {
+        /* Hardware faults raise again with default action when handler return */
+        signal(code, SIG_DFL);
+        if (!info || info->si_code <= 0)
+        {
+            raise(code);
+        }
+    }
+}
+
+static void* csfx__vm_reserve(size_t size)
+{
+    void* ptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+static int csfx__vm_commit(void* ptr, size_t size)
+{
+    return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+static void csfx__vm_release(void* ptr, size_t size)
+{
+    munmap(ptr, size);
+}
+
+static long long csfx__monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int csfx__timer_settime(long long deadline)
+{
+# if defined(__linux__) && defined(sigev_notify_thread_id)
+    csfx__thread_t* thread = &csfx__thread;
+    if (!thread->timerok)
+    {
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify           = SIGEV_THREAD_ID;
+        sev.sigev_signo            = CSFX_TIMEOUT_SIGNAL;
+        sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(CLOCK_MONOTONIC, &sev, &thread->timer) != 0)
+        {
+	    return -1;
+        }
+        thread->timerok = 1;
+    }
+
+    /* Zero it_value disarm the timer */
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = (time_t)(deadline / 1000000000LL);
+    its.it_value.tv_nsec = (long)(deadline % 1000000000LL);
+
+    thread->deadline = deadline;
+    if (timer_settime(thread->timer, TIMER_ABSTIME, &its, NULL) != 0)
+    {
+        thread->deadline = 0;
+        return -1;
+    }
+    return 0;
+# else
+    (void)deadline;
+    return -1;
+# endif
+}
+
+/* Budget belong to the innermost frame, timer is armed to the nearest deadline */
+static int csfx__timeout_arm(long budget_us)
+{
+    csfx__thread_t* thread = &csfx__thread;
+    csfx__frame_t*  frame  = thread->frames;
+    if (!frame)
+    {
+        return -1;
+    }
+
+    frame->deadline = csfx__monotonic_ns() + (long long)budget_us * 1000LL;
+    if (thread->deadline == 0 || frame->deadline < thread->deadline)
+    {
+        return csfx__timer_settime(frame->deadline);
+    }
+    return 0;
+}
+
+/* Call after the timed frame is left, re-arm for outer timed frames */
+static void csfx__timeout_disarm(void)
+{
+    csfx__thread_t* thread = &csfx__thread;
+    
+    long long      next  = 0;
+    csfx__frame_t* frame = thread->frames;
+    for (; frame; frame = frame->prev)
+    {
+        if (frame->deadline && (!next || frame->deadline < next))
+        {
+            next = frame->deadline;
+        }
+    }
+
+    if (next != thread->deadline)
+    {
+        csfx__timer_settime(next);
+    }
+}
+
+/* Expiration may be delivered after disarm, ignore stale signals */
+static csfx__frame_t* csfx__timeout_frame(const void* sp)
+{
+    csfx__thread_t* thread = &csfx__thread;
+    csfx__frame_t*  frame  = thread->frames;
+    long long       now    = csfx__monotonic_ns();
+
+    for (; frame; frame = frame->prev)
+    {
+        if (frame->deadline && now >= frame->deadline && (!sp || (const char*)frame >= (const char*)sp))
+        {
+            thread->frames  = frame->prev;
+            thread->deadline = 0;
+            frame->state    = CSFX__FRAME_DONE;
+            return frame;
+        }
+    }
+    return NULL;
+}
+
+static int csfx__is_stackoverflow(const void* addr)
+{
+    const csfx__thread_t* thread = &csfx__thread;
+    const char*           ptr    = (const char*)addr;
+    return ptr >= thread->guardlo && ptr < thread->guardhi;
+}
+
+static long csfx__last_modify_time(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+
+    return (long)st.st_mtime;
+}
+
+/* Copy in process, no shell: paths may have spaces, and loader threads copy at once.
+ * Destination is unlinked first, a mapping of an old copy keeps its pages */
+static int csfx__copy_file(const char* from_path, const char* to_path)
+{
+    struct stat st;
+    int         in = open(from_path, O_RDONLY | O_CLOEXEC);
+    if (in < 0 || fstat(in, &st) != 0)
+    {
+        if (in >= 0) close(in);
+        return 0;
+    }
+
+    unlink(to_path);
+    int out = open(to_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (out < 0)
+    {
+        close(in);
+        return 0;
+    }
+
+    off_t copied = 0;
+# if defined(SYS_copy_file_range)
+    /* In kernel, shared extents on file systems that support it */
+    while (copied < st.st_size)
+    {
+        ssize_t size = (ssize_t)syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)(st.st_size - copied), 0);
+        if (size <= 0)
+        {
+            break;
+        }
+        copied += size;
+    }
+# endif
+
+    /* Rest by read and write, when copy_file_range is missing or refused */
+    char    buffer[64 * 1024];
+    ssize_t size   = 0;
+    int     failed = 0;
+    while (!failed && (size = pread(in, buffer, sizeof(buffer), copied)) != 0)
+    {
+        if (size < 0)
+        {
+            failed = errno != EINTR;
+            continue;
+        }
+        for (ssize_t done = 0; !failed && done < size; )
+        {
+            ssize_t res = write(out, buffer + done, (size_t)(size - done));
+            failed = res < 0 && errno != EINTR;
+            done  += res > 0 ? res : 0;
+        }
+        copied += size;
+    }
+
+    close(in);
+    failed |= close(out) != 0;
+    if (failed)
+    {
+        unlink(to_path);
+    }
+    return !failed;
+}
+
+static void* csfx__context_pc(void* context)
+{
+# if defined(__linux__) && defined(__x86_64__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.gregs[REG_RIP];
+# elif defined(__linux__) && defined(__i386__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.gregs[REG_EIP];
+# elif defined(__linux__) && defined(__aarch64__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.pc;
+# elif defined(__linux__) && defined(__arm__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.arm_pc;
+# else
+    (void)context;
+    return NULL;
+# endif
+}
+
+static void* csfx__context_sp(void* context)
+{
+# if defined(__linux__) && defined(__x86_64__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.gregs[REG_RSP];
+# elif defined(__linux__) && defined(__i386__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.gregs[REG_ESP];
+# elif defined(__linux__) && defined(__aarch64__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.sp;
+# elif defined(__linux__) && defined(__arm__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.arm_sp;
+# else
+    (void)context;
+    return NULL;
+# endif
+}
+
+/* Return address of a leaf function at its fault. On x86-64 it is on top of the stack,
+ * read only when sp lies in the stack of thread, which did not overflow */
+static void* csfx__context_ra(void* context, int errcode)
+{
+# if defined(__linux__) && defined(__x86_64__)
+    const csfx__thread_t* thread = &csfx__thread;
+    char*                 sp     = (char*)csfx__context_sp(context);
+    if (errcode == CSFX_ERROR_STACKOVERFLOW || sp < thread->guardhi || sp + sizeof(void*) > thread->stackhi)
+    {
+        return NULL;
+    }
+    return *(void**)sp;
+# elif defined(__linux__) && defined(__aarch64__)
+    (void)errcode;
+    return (void*)((ucontext_t*)context)->uc_mcontext.regs[30];
+# else
+    (void)context;
+    (void)errcode;
+    return NULL;
+# endif
+}
+
+/* Async-signal-safe, only write to thread local storage */
+static void csfx__fault_capture(int code, int errcode, siginfo_t* info, void* context)
+{
+    csfx_fault_t* fault = &csfx__thread.fault;
+
+    fault->errcode = errcode;
+    fault->signo   = code;
+    fault->addr    = info && errcode != CSFX_ERROR_TIMEOUT ? info->si_addr : NULL;
+    fault->pc      = context ? csfx__context_pc(context) : NULL;
+    fault->depth   = 0;
+
+    if (fault->pc)
+    {
+        fault->frames[fault->depth++] = fault->pc;
+    }
+}
+
+/* Only for owned faults, backtrace was primed by csfx_init so it does not load libgcc here */
+static void csfx__fault_backtrace(void)
+{
+# if defined(CSFX__BACKTRACE)
+    csfx_fault_t* fault = &csfx__thread.fault;
+
+    /* Skip frames of signal handler, continue from faulting frame */
+    void* frames[CSFX_MAX_BACKTRACE + 4];
+    int   count = backtrace(frames, (int)csfx__countof(frames));
+    int   start = 0;
+    int   idx;
+    for (idx = 0; idx < count && fault->pc; idx++)
+    {
+        if (frames[idx] == fault->pc)
+        {
+            start = idx + 1;
+            break;
+        }
+    }
+
+    for (idx = start; idx < count && fault->depth < CSFX_MAX_BACKTRACE; idx++)
+    {
+        fault->frames[fault->depth++] = frames[idx];
+    }
+# endif
+}
+
+static void csfx__fault_symbolize(const csfx_fault_t* fault, char* buffer, int length)
+{
+    int len = snprintf(buffer, length, "signal %d at address %p, pc %p\n",
+                       fault->signo, fault->addr, fault->pc);
+
+    int idx;
+    for (idx = 0; idx < fault->depth && len > 0 && len < length; idx++)
+    {
+        Dl_info info;
+        void*   addr = fault->frames[idx];
+        if (dladdr(addr, &info) && info.dli_fname)
+        {
+            if (info.dli_sname)
+            {
+                len += snprintf(buffer + len, length - len, "#%-2d %p %s(%s+0x%lx)\n",
+                                idx, addr, info.dli_fname, info.dli_sname,
+                                (unsigned long)((char*)addr - (char*)info.dli_saddr));
+            }
+            else
+            {
+                len += snprintf(buffer + len, length - len, "#%-2d %p %s(+0x%lx)\n",
+                                idx, addr, info.dli_fname,
+                                (unsigned long)((char*)addr - (char*)info.dli_fbase));
+            }
+        }
+        else
+        {
+            len += snprintf(buffer + len, length - len, "#%-2d %p ??\n", idx, addr);
+        }
+    }
+}
+
+/* Symbolize now, the faulted version may be unloaded after recovery */
+static void csfx__fault_store(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+
+    data_t* data = *(data_t**)(&script->internal);
+    if (data)
+    {
+        char buffer[CSFX__MAX_FAULTMSG];
+        csfx__fault_symbolize(&csfx__thread.fault, buffer, CSFX__MAX_FAULTMSG);
+        
+        while (__sync_lock_test_and_set(&data->faultlock, 1))
+        {
+            sched_yield();
+        }
+        data->fault = csfx__thread.fault;
+        memcpy(data->faultmsg, buffer, CSFX__MAX_FAULTMSG);
+        __sync_lock_release(&data->faultlock);
+    }
+}
+
+/* @impl: csfx__fault_filter */
+int csfx__fault_filter(csfx_script_t* script, const csfx__frame_t* frame)
+{
+    int errcode = frame->errcode;
+    if (errcode <= CSFX_ERROR_NONE || errcode > CSFX_ERROR_TIMEOUT)
+    {
+        return 0;
+    }
+
+    if (script)
+    {
+        script->errcode = errcode;
+        csfx__fault_store(script);
+    }
+    return 1;
+}
+
+static int csfx__signal_errcode(int code, const siginfo_t* info)
+{
+    switch (code)
+    {
+    case SIGILL:
+        return CSFX_ERROR_ILLCODE;
+
+    case SIGBUS:
+        return CSFX_ERROR_MISALIGN;
+
+    case SIGSYS:
+        return CSFX_ERROR_SYSCALL;
+
+    case SIGABRT:
+    case SIGKILL:
+        return CSFX_ERROR_ABORT;
+
+    case SIGSEGV:
+        if (info && csfx__is_stackoverflow(info->si_addr))
+        {
+            return CSFX_ERROR_STACKOVERFLOW;
+        }
+        else
+        {
+            return CSFX_ERROR_SEGFAULT;
+        }
+        
+    default:
+        return CSFX_ERROR_NONE;
+    }
+}
+
+static void csfx__sighandler(int code, siginfo_t* info, void* context)
+{
+    int errcode;
+
+    if (code == CSFX_TIMEOUT_SIGNAL)
+    {
+        csfx__frame_t* frame = csfx__timeout_frame(csfx__context_sp(context));
+        if (!frame)
+        {
+            return;
+        }
+
+        csfx__fault_capture(code, CSFX_ERROR_TIMEOUT, info, context);
+        csfx__fault_backtrace();
+        
+        frame->errcode = CSFX_ERROR_TIMEOUT;
+        siglongjmp(frame->env, 1);
+    }
+    
+    errcode = csfx__signal_errcode(code, info);
+    csfx__fault_capture(code, errcode, info, context);
+    if (!csfx__thread.frames || !csfx__fault_owned(&csfx__thread.fault, csfx__context_ra(context, errcode)))
+    {
+        csfx__sigchain(code, info, context);
+        return;
+    }
+
+    csfx__frame_t* frame = csfx__frame_pop(csfx__context_sp(context));
+    if (!frame)
+    {
+        csfx__sigchain(code, info, context);
+        return;
+    }
+    csfx__fault_backtrace();
+    
+    frame->errcode = errcode;
+    siglongjmp(frame->env, 1);
+}
+
+
+int  csfx_init(void)
+{
+    struct sigaction sa;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags     = SA_SIGINFO | SA_RESTART | SA_NODEFER | SA_ONSTACK;
+    sa.sa_handler   = NULL;
+    sa.sa_sigaction = csfx__sighandler;
+
+    /* Other threads prepare themselves on the first guarded call */
+    csfx__thread_prepare();
+
+# if defined(CSFX__BACKTRACE)
+    /* First call of backtrace may load libgcc, which is not async-signal-safe */
+    void* frame;
+    backtrace(&frame, 1);
+# endif
+
+    int idx;
+    for (idx = 0; idx < (int)csfx__countof(csfx__signals); idx++)
+    {
+        if (sigaction(csfx__signals[idx], &sa, &csfx__oldactions[idx]) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (sigaction(CSFX_TIMEOUT_SIGNAL, &sa, &csfx__oldtimeout) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void csfx_quit(void)
+{
+    int idx;
+    for (idx = 0; idx < (int)csfx__countof(csfx__signals); idx++)
+    {
+        sigaction(csfx__signals[idx], &csfx__oldactions[idx], NULL);
+    }
+    sigaction(CSFX_TIMEOUT_SIGNAL, &csfx__oldtimeout, NULL);
+
+    csfx__thread_free(&csfx__thread);
+    pthread_setspecific(csfx__thread_key, NULL);
+}
+#else
+#error "Unsupported platform"
+#endif
+
+static int csfx__remove_file(const char* path)
+{
+    return remove(path) == 0;
+}
+
+#if defined(CSFX_LIBTCC)
+/** Embedded TinyCC: script source compiled into memory, symbols resolved by its table **/
+
+/* Options of compiler, as on its command line */
+#ifndef CSFX_LIBTCC_OPTIONS
+#define CSFX_LIBTCC_OPTIONS ""
+#endif
+
+/* Errors of last failed compile, read by csfx_script_errmsg */
+static char csfx__tcc_errors[CSFX__MAX_FAULTMSG];
+
+/* Scripts compiled in memory, loaded on any thread */
+static csfx__tcc_t* csfx__tccs;
+#if defined(_WIN32)
+static SRWLOCK         csfx__tccs_lock = SRWLOCK_INIT;
+# define csfx__tccs_acquire() AcquireSRWLockExclusive(&csfx__tccs_lock)
+# define csfx__tccs_release() ReleaseSRWLockExclusive(&csfx__tccs_lock)
+#else
+static pthread_mutex_t csfx__tccs_lock = PTHREAD_MUTEX_INITIALIZER;
+# define csfx__tccs_acquire() pthread_mutex_lock(&csfx__tccs_lock)
+# define csfx__tccs_release() pthread_mutex_unlock(&csfx__tccs_lock)
+#endif
+
+typedef struct
+{
+    char   text[CSFX__MAX_FAULTMSG];
+    size_t len;
+} csfx__tcc_log_t;
+
+static void csfx__tcc_error(void* opaque, const char* msg)
+{
+    csfx__tcc_log_t* log = (csfx__tcc_log_t*)opaque;
+    int              len = snprintf(log->text + log->len, sizeof(log->text) - log->len, "%s\n", msg);
+    if (len > 0)
+    {
+        log->len += (size_t)len < sizeof(log->text) - log->len ? (size_t)len : sizeof(log->text) - log->len - 1;
+    }
+}
+
+static int csfx__tcc_source(const char* path)
+{
+    size_t len = strlen(path);
+    return len > 2 && strcmp(path + len - 2, ".c") == 0;
+}
+
+static int csfx__tcc_owns(void* library)
+{
+    csfx__tccs_acquire();
+    csfx__tcc_t* tcc = csfx__tccs;
+    while (tcc && tcc != library)
+    {
+        tcc = tcc->next;
+    }
+    csfx__tccs_release();
+    return tcc != NULL;
+}
+
+static long long csfx__file_stamp(const char* path);
+
+/* Header of csfx_build_pch kept in memory and compiled ahead of each script.
+ * A compiler state cannot be used again once relocated, so it is the header text that persists:
+ * read once per change, never from disk by each reload. Guarded by csfx__tccs_lock */
+static char      csfx__tcc_header[CSFX__MAX_PATH];
+static char*     csfx__tcc_prelude;
+static long long csfx__tcc_stamp;
+
+static char* csfx__tcc_read(const char* path, size_t* len)
+{
+    FILE* file = fopen(path, "rb");
+    char* text = NULL;
+    long  size = file && fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (size >= 0 && fseek(file, 0, SEEK_SET) == 0 && (text = (char*)malloc((size_t)size + 1)) != NULL)
+    {
+        *len       = fread(text, 1, (size_t)size, file);
+        text[*len] = 0;
+    }
+    if (file)
+    {
+        fclose(file);
+    }
+    return text;
+}
+
+static void csfx__tcc_set_header(const char* header)
+{
+    csfx__tccs_acquire();
+    free(csfx__tcc_prelude);
+    csfx__tcc_prelude = NULL;
+    csfx__tcc_stamp   = 0;
+    snprintf(csfx__tcc_header, sizeof(csfx__tcc_header), "%s", header);
+    csfx__tccs_release();
+}
+
+/* Directory of file as include path, quoted includes of compiled text resolve as from the file */
+static void csfx__tcc_include_dir(CSFX_LIBTCC_STATE* state, const char* path)
+{
+    char        dir[CSFX__MAX_PATH];
+    const char* slash = strrchr(path, '/');
+#if defined(_WIN32)
+    const char* back  = strrchr(path, '\\');
+    slash = back > slash ? back : slash;
+#endif
+    if (slash && (size_t)(slash - path) < sizeof(dir))
+    {
+        memcpy(dir, path, (size_t)(slash - path));
+        dir[slash - path] = 0;
+        tcc_add_include_path(state, dir[0] ? dir : "/");
+    }
+}
+
+/* Source of script after the preloaded header, lines numbered as in its file
+ * @return: NULL when there is no header, source is compiled from its file */
+static char* csfx__tcc_prepare(CSFX_LIBTCC_STATE* state, const char* path)
+{
+    char* text = NULL;
+    csfx__tccs_acquire();
+    long long stamp = csfx__tcc_header[0] ? csfx__file_stamp(csfx__tcc_header) : 0;
+    if (stamp != csfx__tcc_stamp)
+    {
+        size_t len = 0;
+        free(csfx__tcc_prelude);
+        csfx__tcc_prelude = stamp ? csfx__tcc_read(csfx__tcc_header, &len) : NULL;
+        csfx__tcc_stamp   = csfx__tcc_prelude ? stamp : 0;
+    }
+
+    size_t len    = 0;
+    char*  source = csfx__tcc_prelude ? csfx__tcc_read(path, &len) : NULL;
+    if (source)
+    {
+        size_t size = strlen(csfx__tcc_header) + strlen(csfx__tcc_prelude) + strlen(path) + len + 64;
+        text = (char*)malloc(size);
+        if (text)
+        {
+            snprintf(text, size, "#line 1 \"%s\"\n%s\n#line 1 \"%s\"\n%s", csfx__tcc_header, csfx__tcc_prelude, path, source);
+            csfx__tcc_include_dir(state, csfx__tcc_header);
+            csfx__tcc_include_dir(state, path);
+        }
+        free(source);
+    }
+    csfx__tccs_release();
+    return text;
+}
+
+#if !defined(TCC_RELOCATE_AUTO)
+/* Memory of relocated script is owned by compiler, its range spans the pages of its symbols */
+static void csfx__tcc_range(void* ctx, const char* name, const void* value)
+{
+    csfx__tcc_t* tcc  = (csfx__tcc_t*)ctx;
+    char*        addr = (char*)value;
+    (void)name;
+
+    char* lo = tcc->image && tcc->image < addr ? tcc->image : addr;
+    char* hi = tcc->image && tcc->image + tcc->size > addr ? tcc->image + tcc->size : addr + 1;
+    tcc->image = lo;
+    tcc->size  = (size_t)(hi - lo);
+}
+#endif
+
+/* Compile and relocate source, no file is written.
+ * libtcc 0.9.27 and older relocate into memory given by caller (two-argument tcc_relocate, with
+ * TCC_RELOCATE_AUTO), later ones into memory of their own (one-argument tcc_relocate) */
+static void* csfx__tcc_load(const char* path)
+{
+    csfx__tcc_log_t log;
+    log.text[0] = 0;
+    log.len     = 0;
+
+    csfx__tcc_t* tcc = (csfx__tcc_t*)calloc(1, sizeof(csfx__tcc_t));
+    if (!tcc || !(tcc->state = tcc_new()))
+    {
+        free(tcc);
+        return NULL;
+    }
+
+    tcc_set_error_func(tcc->state, &log, csfx__tcc_error);
+#if defined(CSFX_LIBTCC_PATH)
+    tcc_set_lib_path(tcc->state, CSFX_LIBTCC_PATH);
+#endif
+    tcc_set_options(tcc->state, CSFX_LIBTCC_OPTIONS);
+    tcc_set_output_type(tcc->state, TCC_OUTPUT_MEMORY);
+
+    char* text  = csfx__tcc_prepare(tcc->state, path);
+    int   added = text ? tcc_compile_string(tcc->state, text) != -1 : tcc_add_file(tcc->state, path) != -1;
+    free(text);
+#if defined(TCC_RELOCATE_AUTO)
+    int size  = added ? tcc_relocate(tcc->state, NULL) : -1;
+
+    /* Own the image, its range is script text for fault handling */
+    if (size > 0)
+    {
+    #if defined(_WIN32)
+        tcc->image = (char*)VirtualAlloc(NULL, (SIZE_T)size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    #else
+        tcc->image = (char*)mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        tcc->image = tcc->image != (char*)MAP_FAILED ? tcc->image : NULL;
+    #endif
+        tcc->size  = (size_t)size;
+    }
+    int relocated = tcc->image && tcc_relocate(tcc->state, tcc->image) >= 0;
+#else
+    int relocated = added && tcc_relocate(tcc->state) >= 0;
+    if (relocated)
+    {
+        tcc_list_symbols(tcc->state, tcc, csfx__tcc_range);
+
+        size_t page = 4096;
+        char*  lo   = (char*)((size_t)tcc->image & ~(page - 1));
+        tcc->size   = tcc->image ? ((size_t)(tcc->image + tcc->size - lo) + page - 1) & ~(page - 1) : 0;
+        tcc->image  = tcc->image ? lo : NULL;
+    }
+#endif
+
+    if (!relocated)
+    {
+        memcpy(csfx__tcc_errors, log.text, log.len + 1);
+    #if defined(TCC_RELOCATE_AUTO)
+        if (tcc->image)
+        {
+        #if defined(_WIN32)
+            VirtualFree(tcc->image, 0, MEM_RELEASE);
+        #else
+            munmap(tcc->image, tcc->size);
+        #endif
+        }
+    #endif
+        tcc_delete(tcc->state);
+        free(tcc);
+        return NULL;
+    }
+
+    csfx__tccs_acquire();
+    tcc->next  = csfx__tccs;
+    csfx__tccs = tcc;
+    csfx__tccs_release();
+
+    if (tcc->image)
+    {
+        csfx__text_register_range(tcc, tcc->image, tcc->image + tcc->size);
+    }
+    return tcc;
+}
+
+static void csfx__tcc_free(void* library)
+{
+    csfx__tcc_t*  tcc = (csfx__tcc_t*)library;
+    csfx__tcc_t** ptr = &csfx__tccs;
+
+    csfx__tccs_acquire();
+    while (*ptr && *ptr != tcc)
+    {
+        ptr = &(*ptr)->next;
+    }
+    if (*ptr)
+    {
+        *ptr = tcc->next;
+    }
+    csfx__tccs_release();
+
+    tcc_delete(tcc->state);
+#if defined(TCC_RELOCATE_AUTO)
+# if defined(_WIN32)
+    VirtualFree(tcc->image, 0, MEM_RELEASE);
+# else
+    munmap(tcc->image, tcc->size);
+# endif
+#endif
+    free(tcc);
+}
+#endif /* CSFX_LIBTCC */
+
+static void* csfx__library_load(const char* path)
+{
+    void* library = csfx__dlib_load(path);
+    if (library)
+    {
+        csfx__text_register(library);
+    }
+    return library;
+}
+
+static void csfx__library_free(void* library)
+{
+    csfx__text_unregister(library);
+#if defined(CSFX_LIBTCC)
+    if (csfx__tcc_owns(library))
+    {
+        csfx__tcc_free(library);
+        return;
+    }
+#endif
+    csfx__dlib_free(library);
+}
+
+static int csfx__get_temp_path(const char* path, char* buffer, int length)
+{
+    int res = -1;
+    
+    if (buffer)
+    { 
+        int version = 0;
+        while (1)
+        {
+            res = snprintf(buffer, length, "%s.%d", path, version++);
+            if (res < 0 || res >= length)
+            {
+                res = -1;
+                break;
+            }
+
+        #if defined(_MSC_VER) && _MSC_VER >= 1200
+            FILE* file;
+            if (fopen_s(&file, buffer, "r") != 0)
+            {
+                file = NULL;
+            }
+        #else
+            FILE* file = fopen(buffer, "r");
+        #endif
+
+            if (file)
+            {
+                fclose(file);
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    return res;
+}
+
+/* Modify time with full precision of file system, 0 when file not exists */
+static long long csfx__file_stamp(const char* path)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &fad))
+    {
+        return 0;
+    }
+
+    LARGE_INTEGER time;
+    time.LowPart  = fad.ftLastWriteTime.dwLowDateTime;
+    time.HighPart = fad.ftLastWriteTime.dwHighDateTime;
+    return (long long)time.QuadPart;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+
+# if defined(__APPLE__)
+    return (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+# else
+    return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+# endif
+#endif
+}
+
+/** Loaded libraries cache: scripts of one library share one shadow copy and one mapping **/
+typedef struct csfx__shared csfx__shared_t;
+struct csfx__shared
+{
+    csfx__shared_t*    next;
+    void*              library;  /* NULL while loading, or retired with globals */
+    int                loading;
+    int                refs;     /* Scripts holding the mapping */
+    int                entered;  /* Scripts whose init or reload event ran on it */
+    void*              globals;  /* Saved by the last script leaving it, for the next version */
+    void**             patches;  /* Patch libraries applied over it, freed with it */
+    int                patchcount;
+    csfx__jump_t*      jumps;    /* Resolved from patches, not written yet while guarded calls run */
+    int                jumpcount;
+    const void*        owner;    /* Arena of the only script of a copy exporting csfx_arena, NULL when shared */
+    int                checks;   /* Change checks of scripts, the file is probed once per round of them */
+    long long          latest;   /* Stamp of the file at the last probe */
+    unsigned long      stamp;    /* When it was last entered or saved, latest state is carried */
+    unsigned long long dev;      /* Identity of the copied file */
+    unsigned long long ino;
+    unsigned long long size;
+    long long          time;
+    char               realpath[CSFX__MAX_PATH];
+    char               libtpath[CSFX__MAX_PATH];
+};
+
+static csfx__shared_t* csfx__shareds;
+static unsigned long   csfx__shareds_clock;
+
+#if defined(_WIN32)
+static SRWLOCK            csfx__shareds_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE csfx__shareds_cond = CONDITION_VARIABLE_INIT;
+# define csfx__shareds_acquire()   AcquireSRWLockExclusive(&csfx__shareds_lock)
+# define csfx__shareds_release()   ReleaseSRWLockExclusive(&csfx__shareds_lock)
+# define csfx__shareds_wait()      SleepConditionVariableSRW(&csfx__shareds_cond, &csfx__shareds_lock, INFINITE, 0)
+# define csfx__shareds_broadcast() WakeAllConditionVariable(&csfx__shareds_cond)
+#else
+static pthread_mutex_t csfx__shareds_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  csfx__shareds_cond = PTHREAD_COND_INITIALIZER;
+# define csfx__shareds_acquire()   pthread_mutex_lock(&csfx__shareds_lock)
+# define csfx__shareds_release()   pthread_mutex_unlock(&csfx__shareds_lock)
+# define csfx__shareds_wait()      pthread_cond_wait(&csfx__shareds_cond, &csfx__shareds_lock)
+# define csfx__shareds_broadcast() pthread_cond_broadcast(&csfx__shareds_cond)
+#endif
+
+/* Canonical path and identity of a file, a new version has a new identity */
+static int csfx__file_identity(const char* path, csfx__shared_t* key)
+{
+    memset(key, 0, sizeof(*key));
+
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &fad)
+        || !GetFullPathNameA(path, CSFX__MAX_PATH, key->realpath, NULL))
+    {
+        return -1;
+    }
+    key->size = ((unsigned long long)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    key->time = csfx__file_stamp(path);
+#else
+    struct stat st;
+    char        real[PATH_MAX];
+    if (stat(path, &st) != 0 || !realpath(path, real))
+    {
+        return -1;
+    }
+    snprintf(key->realpath, sizeof(key->realpath), "%.*s", (int)sizeof(key->realpath) - 1, real);
+    key->dev  = (unsigned long long)st.st_dev;
+    key->ino  = (unsigned long long)st.st_ino;
+    key->size = (unsigned long long)st.st_size;
+    key->time = csfx__file_stamp(path);
+#endif
+    return 0;
+}
+
+static csfx__shared_t* csfx__shareds_find(void* library)
+{
+    csfx__shared_t* entry;
+    for (entry = csfx__shareds; entry && entry->library != library; entry = entry->next)
+    {
+    }
+    return library ? entry : NULL;
+}
+
+static void csfx__shareds_drop(csfx__shared_t* entry)
+{
+    csfx__shared_t** link;
+    for (link = &csfx__shareds; *link != entry; link = &(*link)->next)
+    {
+    }
+    *link = entry->next;
+    free(entry);
+}
+
+/* Load library, or share the mapping of its version already loaded by another script.
+ * Safe on any thread, scripts of different libraries load in parallel */
+static void* csfx__library_acquire(const char* librpath, const void* owner)
+{
+    csfx__shared_t key;
+    if (csfx__file_identity(librpath, &key) != 0)
+    {
+        return NULL;
+    }
+
+    csfx__shareds_acquire();
+
+    csfx__shared_t* entry;
+    for (;;)
+    {
+        for (entry = csfx__shareds; entry; entry = entry->next)
+        {
+            if ((entry->library || entry->loading) && (!entry->owner || entry->owner == owner)
+                && entry->dev == key.dev && entry->ino == key.ino && entry->size == key.size && entry->time == key.time
+                && strcmp(entry->realpath, key.realpath) == 0)
+            {
+                break;
+            }
+        }
+
+        if (!entry || !entry->loading)
+        {
+            break;
+        }
+        csfx__shareds_wait();
+    }
+
+    if (entry)
+    {
+        entry->refs++;
+        csfx__shareds_release();
+        return entry->library;
+    }
+
+    entry = (csfx__shared_t*)malloc(sizeof(csfx__shared_t));
+    if (!entry)
+    {
+        csfx__shareds_release();
+        return NULL;
+    }
+    *entry = key;
+    entry->loading = 1;
+    entry->refs    = 1;
+
+    /* Shadow path which is neither on disk nor taken by a library being copied */
+    int version = 0, taken = 1;
+    while (taken)
+    {
+        snprintf(entry->libtpath, sizeof(entry->libtpath), "%s.%d", librpath, version++);
+
+    #if defined(_MSC_VER) && _MSC_VER >= 1200
+        FILE* file;
+        if (fopen_s(&file, entry->libtpath, "r") != 0)
+        {
+            file = NULL;
+        }
+    #else
+        FILE* file = fopen(entry->libtpath, "r");
+    #endif
+
+        taken = file != NULL;
+        if (file)
+        {
+            fclose(file);
+        }
+
+        csfx__shared_t* other;
+        for (other = csfx__shareds; other && !taken; other = other->next)
+        {
+            taken = strcmp(other->libtpath, entry->libtpath) == 0;
+        }
+    }
+    entry->next   = csfx__shareds;
+    csfx__shareds = entry;
+    csfx__shareds_release();
+
+    void* library = NULL;
+#if defined(CSFX_LIBTCC)
+    if (csfx__tcc_source(librpath))
+    {
+        library = csfx__tcc_load(librpath);
+    }
+    else
+#endif
+    if (csfx__copy_file(librpath, entry->libtpath))
+    {
+        library = csfx__library_load(entry->libtpath);
+    }
+
+    /* csfx_arena is one global of the mapping, scripts with their own arena cannot share it */
+    csfx__shareds_acquire();
+    entry->loading = 0;
+    entry->library = library;
+    entry->owner   = library && csfx__library_symbol(library, "csfx_arena") ? owner : NULL;
+    if (!library)
+    {
+        csfx__remove_file(entry->libtpath);
+        csfx__shareds_drop(entry);
+    }
+    csfx__shareds_broadcast();
+    csfx__shareds_release();
+    return library;
+}
+
+/* Unmap library when no script hold it anymore */
+static void csfx__library_release(void* library)
+{
+    char   libtpath[CSFX__MAX_PATH];
+    int    last       = 0;
+    void** patches    = NULL;
+    int    patchcount = 0;
+
+    csfx__shareds_acquire();
+    csfx__shared_t* entry = csfx__shareds_find(library);
+    if (entry && --entry->refs == 0)
+    {
+        last = 1;
+        memcpy(libtpath, entry->libtpath, sizeof(libtpath));
+        patches           = entry->patches;
+        patchcount        = entry->patchcount;
+        entry->patches    = NULL;
+        entry->patchcount = 0;
+        entry->jumpcount  = 0;
+        free(entry->jumps);
+        entry->jumps      = NULL;
+
+        /* Retired, keep globals until the next version take them */
+        entry->library = NULL;
+        if (!entry->globals)
+        {
+            csfx__shareds_drop(entry);
+        }
+    }
+    csfx__shareds_release();
+
+    if (last)
+    {
+        while (patchcount > 0)
+        {
+            csfx__library_free(patches[--patchcount]);
+        }
+        free(patches);
+
+        csfx__library_free(library);
+        csfx__remove_file(libtpath);
+    }
+}
+
+/* Script enter library, the first one carries the latest state of other versions:
+ * globals saved by one, or current globals of one still running
+ * @return: saved globals to load, NULL if none */
+static void* csfx__library_enter(void* library)
+{
+    void* globals = NULL;
+
+    csfx__shareds_acquire();
+    csfx__shared_t* entry = csfx__shareds_find(library);
+    if (entry && entry->entered++ == 0)
+    {
+        csfx__shared_t* latest = NULL;
+        csfx__shared_t* other;
+        for (other = csfx__shareds; other; other = other->next)
+        {
+            if (other != entry && (other->globals || other->entered > 0) && other->owner == entry->owner
+                && strcmp(other->realpath, entry->realpath) == 0
+                && (!latest || other->stamp > latest->stamp))
+            {
+                latest = other;
+            }
+        }
+
+        if (latest && latest->globals)
+        {
+            globals         = latest->globals;
+            latest->globals = NULL;
+            if (!latest->library && !latest->loading)
+            {
+                csfx__shareds_drop(latest);
+            }
+        }
+        else if (latest)
+        {
+            globals = csfx__globals_save(latest->library);
+        }
+
+        /* Own saved globals are older than its running image */
+        csfx__globals_load(entry->globals, NULL);
+        entry->globals = NULL;
+        entry->stamp   = ++csfx__shareds_clock;
+    }
+    csfx__shareds_release();
+    return globals;
+}
+
+/* Script leave library, the last one saves globals for the next version when carry */
+static void csfx__library_leave(void* library, int carry)
+{
+    csfx__shareds_acquire();
+    csfx__shared_t* entry = csfx__shareds_find(library);
+    if (entry && --entry->entered == 0 && carry)
+    {
+        /* Only the latest saved globals of a library are kept */
+        csfx__shared_t* other = csfx__shareds;
+        while (other)
+        {
+            csfx__shared_t* next = other->next;
+            if (other->globals && other->owner == entry->owner && strcmp(other->realpath, entry->realpath) == 0)
+            {
+                csfx__globals_load(other->globals, NULL);
+                other->globals = NULL;
+                if (!other->library && !other->loading)
+                {
+                    csfx__shareds_drop(other);
+                }
+            }
+            other = next;
+        }
+        entry->globals = csfx__globals_save(library);
+        entry->stamp   = ++csfx__shareds_clock;
+    }
+    csfx__shareds_release();
+}
+
+/* Stamp of the file of library, probed once for all scripts sharing it:
+ * when every one of them checked since the last probe */
+static long long csfx__library_modify_time(void* library, const char* librpath)
+{
+    csfx__shareds_acquire();
+    csfx__shared_t* entry = csfx__shareds_find(library);
+    long long       time  = 0;
+    if (entry && entry->checks++ % entry->refs != 0)
+    {
+        time = entry->latest;
+    }
+    else
+    {
+        time = csfx__file_stamp(librpath);
+        if (entry)
+        {
+            entry->latest = time;
+        }
+    }
+    csfx__shareds_release();
+    return time;
+}
+
+/* Shadow copy of loaded library, patches link against it for the rest of library */
+static int csfx__library_shadow(void* library, char* path, int length)
+{
+    csfx__shareds_acquire();
+    csfx__shared_t* entry  = csfx__shareds_find(library);
+    int             result = entry && !csfx__tcc_owns(library) ? 0 : -1;
+    if (result == 0)
+    {
+        snprintf(path, length, "%s", entry->libtpath);
+    }
+    csfx__shareds_release();
+    return result;
+}
+
+/* Write jumps of patches that waited for guarded calls in library to end
+ * @return: 0 when all are written, 1 while they still wait, -1 when they cannot be written */
+static int csfx__library_patch_retry(void* library)
+{
+    csfx__shareds_acquire();
+    csfx__shared_t* entry  = csfx__shareds_find(library);
+    int             result = entry ? csfx__patch_write(library, entry->jumps, entry->jumpcount) : 0;
+    if (entry && result != 1)
+    {
+        entry->jumpcount = 0;
+    }
+    csfx__shareds_release();
+    return result;
+}
+
+/* Load patch and redirect functions of library to it, the patch live as long as library.
+ * Scripts sharing library run patched code too. While a guarded call runs in library,
+ * the patch is accepted but written later, by csfx__library_patch_retry
+ * @return: 0 when written, 1 when it waits, -1 when library must be reloaded whole */
+static int csfx__library_patch(void* library, const char* path)
+{
+#if defined(_WIN32)
+    void* patch = csfx__dlib_load(path);
+#else
+    /* Bind now, a function defined by an older patch only is missing here rather than at its call */
+    void* patch = dlopen(path, RTLD_NOW);
+#endif
+    if (!patch)
+    {
+        return -1;
+    }
+    csfx__text_register(patch);
+
+    csfx__shareds_acquire();
+    csfx__shared_t* entry   = csfx__shareds_find(library);
+    void**          patches = entry ? (void**)realloc(entry->patches, sizeof(void*) * (entry->patchcount + 1)) : NULL;
+    int             result  = -1;
+    if (patches)
+    {
+        /* Appended after jumps of older patches that wait, a later jump of one entry wins */
+        entry->patches = patches;
+        result         = csfx__patch_resolve(library, patch, &entry->jumps, &entry->jumpcount);
+        result         = result == 0 ? csfx__patch_write(library, entry->jumps, entry->jumpcount) : -1;
+        if (result != 1)
+        {
+            entry->jumpcount = 0;
+        }
+        if (result >= 0)
+        {
+            entry->patches[entry->patchcount++] = patch;
+        }
+    }
+    csfx__shareds_release();
+
+    if (result < 0)
+    {
+        csfx__library_free(patch);
+    }
+    return result;
+}
+
+static int csfx__script_changed(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+    
+    long long src = data->libtime;
+    long long cur = csfx__library_modify_time(data->library, data->librpath);
+    int       res = cur > src;
+#if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
+    if (res)
+    {  
+        long pdbsrc = data->pdbtime;
+        long pdbcur = csfx__last_modify_time(data->pdbrpath);
+        res = (pdbcur == pdbsrc && pdbcur == 0) || pdbcur > pdbsrc;
+    }
+#endif
+    return res;
+}
+
+static int csfx__file_changed(csfx_filetime_t* ft)
+{
+    long src = ft->time;
+    long cur = csfx__last_modify_time(ft->path);
+    
+    if (cur > src)
+    {
+        ft->time = cur;
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+/** Script arena **/
+
+/* Reserved address range of an arena, committed on demand */
+#ifndef CSFX_ARENA_RESERVE
+#define CSFX_ARENA_RESERVE (sizeof(void*) >= 8 ? ((size_t)1 << 34) : ((size_t)1 << 28))
+#endif
+
+/* Granularity of committing reserved pages */
+#ifndef CSFX_ARENA_COMMIT
+#define CSFX_ARENA_COMMIT (64 * 1024)
+#endif
+
+#define CSFX__ARENA_HEADER   16
+#define CSFX__ARENA_MINCLASS 5
+#define CSFX__ARENA_MAGIC    ((size_t)0xc5f0a7e4)
+
+static void* csfx__arena_alloc(csfx_arena_t* arena, size_t size)
+{
+    size_t need = size + CSFX__ARENA_HEADER;
+    int    cls  = CSFX__ARENA_MINCLASS;
+    while (((size_t)1 << cls) < need)
+    {
+        if (++cls >= 64) return NULL;
+    }
+
+    size_t blocksize = (size_t)1 << cls;
+    if (arena->limit && arena->used + blocksize > arena->limit)
+    {
+        return NULL;
+    }
+
+    char* block = (char*)arena->freelists[cls];
+    if (block)
+    {
+        arena->freelists[cls] = *(void**)(block + CSFX__ARENA_HEADER);
+    }
+    else
+    {
+        if (!arena->base)
+        {
+            arena->base = (char*)csfx__vm_reserve(CSFX_ARENA_RESERVE);
+            if (!arena->base)
+            {
+                return NULL;
+            }
+            arena->reserved  = CSFX_ARENA_RESERVE;
+            arena->committed = 0;
+            arena->top       = 0;
+        }
+
+        if (blocksize > arena->reserved - arena->top)
+        {
+            return NULL;
+        }
+
+        size_t top = arena->top + blocksize;
+        if (top > arena->committed)
+        {
+            size_t commit = (top + CSFX_ARENA_COMMIT - 1) / CSFX_ARENA_COMMIT * CSFX_ARENA_COMMIT;
+            commit = commit < arena->reserved ? commit : arena->reserved;
+            if (!csfx__vm_commit(arena->base + arena->committed, commit - arena->committed))
+            {
+                return NULL;
+            }
+            arena->committed = commit;
+        }
+
+        block      = arena->base + arena->top;
+        arena->top = top;
+    }
+
+    ((size_t*)block)[0] = (size_t)cls;
+    ((size_t*)block)[1] = CSFX__ARENA_MAGIC;
+    arena->used += blocksize;
+    return block + CSFX__ARENA_HEADER;
+}
+
+static void csfx__arena_free(csfx_arena_t* arena, void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    char*  block = (char*)ptr - CSFX__ARENA_HEADER;
+    size_t cls   = ((size_t*)block)[0];
+    if (((size_t*)block)[1] != CSFX__ARENA_MAGIC || cls >= 64)
+    {
+        return; /* Not a block of this arena, or double free */
+    }
+
+    ((size_t*)block)[1] = 0;
+    *(void**)(block + CSFX__ARENA_HEADER) = arena->freelists[cls];
+    arena->freelists[cls] = block;
+    arena->used -= (size_t)1 << cls;
+}
+
+static int csfx__arena_owns(csfx_arena_t* arena, void* ptr)
+{
+    char* block = (char*)ptr - CSFX__ARENA_HEADER;
+    return arena->base
+        && block >= arena->base && block < arena->base + arena->top
+        && ((size_t*)block)[1] == CSFX__ARENA_MAGIC;
+}
+
+static void csfx__arena_init(csfx_arena_t* arena)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->alloc = csfx__arena_alloc;
+    arena->free  = csfx__arena_free;
+}
+
+/* Release all blocks at once */
+static void csfx__arena_release(csfx_arena_t* arena)
+{
+    if (arena->base)
+    {
+        csfx__vm_release(arena->base, arena->reserved);
+    }
+    csfx__arena_init(arena);
+}
+
+/* Hand the arena to script, if it export csfx_arena */
+static void csfx__arena_bind(csfx_arena_t* arena, void* library)
+{
+    csfx_arena_t** slot = (csfx_arena_t**)csfx__library_symbol(library, "csfx_arena");
+    if (slot)
+    {
+        *slot = arena;
+    }
+}
+
+/** State layout migration **/
+
+enum
+{
+    CSFX__MIGRATE_COPY,
+    CSFX__MIGRATE_CONVERT,
+};
+
+typedef struct
+{
+    int      kind;
+    int      dtype, stype;
+    unsigned dst, dsize;
+    unsigned src, ssize;
+} csfx__migrate_t;
+
+static int csfx__field_numeric(int type)
+{
+    return type == CSFX_FIELD_INT || type == CSFX_FIELD_UINT || type == CSFX_FIELD_FLOAT;
+}
+
+static double csfx__field_loadf(const char* ptr, int type, unsigned size, long long* ival)
+{
+    if (type == CSFX_FIELD_FLOAT)
+    {
+        double value = size == sizeof(float) ? (double)*(const float*)ptr : *(const double*)ptr;
+        *ival = (long long)value;
+        return value;
+    }
+
+    switch (size)
+    {
+    case 1: *ival = type == CSFX_FIELD_INT ? (long long)*(const signed char*)ptr : (long long)*(const unsigned char*)ptr;   break;
+    case 2: *ival = type == CSFX_FIELD_INT ? (long long)*(const short*)ptr       : (long long)*(const unsigned short*)ptr;  break;
+    case 4: *ival = type == CSFX_FIELD_INT ? (long long)*(const int*)ptr         : (long long)*(const unsigned int*)ptr;    break;
+    default: memcpy(ival, ptr, sizeof(*ival)); break;
+    }
+    return type == CSFX_FIELD_UINT ? (double)(unsigned long long)*ival : (double)*ival;
+}
+
+static void csfx__field_store(char* ptr, int type, unsigned size, long long ival, double fval)
+{
+    if (type == CSFX_FIELD_FLOAT)
+    {
+        if (size == sizeof(float)) *(float*)ptr = (float)fval;
+        else                       *(double*)ptr = fval;
+        return;
+    }
+
+    switch (size)
+    {
+    case 1: *(char*)ptr  = (char)ival;  break;
+    case 2: *(short*)ptr = (short)ival; break;
+    case 4: *(int*)ptr   = (int)ival;   break;
+    default: memcpy(ptr, &ival, sizeof(ival)); break;
+    }
+}
+
+/* Compile migration plan, adjacent copies are merged into one memcpy */
+static int csfx__migrate_plan(const csfx_layout_t* to, const csfx_layout_t* from, csfx__migrate_t* plan)
+{
+    int i, j, count = 0;
+    for (i = 0; i < to->count; i++)
+    {
+        const csfx_field_t* dfield = &to->fields[i];
+        const csfx_field_t* sfield = NULL;
+        for (j = 0; j < from->count; j++)
+        {
+            if (strcmp(from->fields[j].name, dfield->name) == 0)
+            {
+                sfield = &from->fields[j];
+                break;
+            }
+        }
+
+        if (!sfield)
+        {
+            continue; /* New field, zeroed */
+        }
+
+        csfx__migrate_t op;
+        op.dtype = dfield->type; op.dst = dfield->offset; op.dsize = dfield->size;
+        op.stype = sfield->type; op.src = sfield->offset; op.ssize = sfield->size;
+
+        if (op.dtype == op.stype && (op.dsize == op.ssize || !csfx__field_numeric(op.dtype)))
+        {
+            op.kind  = CSFX__MIGRATE_COPY;
+            op.dsize = op.ssize = op.dsize < op.ssize ? op.dsize : op.ssize;
+
+            csfx__migrate_t* prev = count > 0 ? &plan[count - 1] : NULL;
+            if (prev && prev->kind == CSFX__MIGRATE_COPY
+                && prev->dst + prev->dsize == op.dst && prev->src + prev->ssize == op.src)
+            {
+                prev->dsize += op.dsize;
+                prev->ssize += op.ssize;
+                continue;
+            }
+        }
+        else if (csfx__field_numeric(op.dtype) && csfx__field_numeric(op.stype))
+        {
+            op.kind = CSFX__MIGRATE_CONVERT;
+        }
+        else
+        {
+            continue; /* Incompatible types, zeroed */
+        }
+
+        plan[count++] = op;
+    }
+    return count;
+}
+
+/* @impl: csfx_layout_migrate */
+int csfx_layout_migrate(const csfx_layout_t* to, void* dst,
+                        const csfx_layout_t* from, const void* src, size_t count)
+{
+    if (!to || !from || !dst || !src)
+    {
+        return -1;
+    }
+
+    csfx__migrate_t* plan = (csfx__migrate_t*)malloc(sizeof(csfx__migrate_t) * (to->count > 0 ? to->count : 1));
+    if (!plan)
+    {
+        return -1;
+    }
+
+    int    i, ops = csfx__migrate_plan(to, from, plan);
+    size_t n;
+    for (n = 0; n < count; n++)
+    {
+        char*       drec = (char*)dst + n * to->size;
+        const char* srec = (const char*)src + n * from->size;
+
+        memset(drec, 0, to->size);
+        for (i = 0; i < ops; i++)
+        {
+            const csfx__migrate_t* op = &plan[i];
+            if (op->kind == CSFX__MIGRATE_COPY)
+            {
+                memcpy(drec + op->dst, srec + op->src, op->dsize);
+            }
+            else
+            {
+                long long ival;
+                double    fval = csfx__field_loadf(srec + op->src, op->stype, op->ssize, &ival);
+                csfx__field_store(drec + op->dst, op->dtype, op->dsize, ival, fval);
+            }
+        }
+    }
+
+    free(plan);
+    return 0;
+}
+
+/* Copy layout of library, it must outlive the library */
+static csfx_layout_t* csfx__layout_clone(void* library)
+{
+    const csfx_layout_t* layout = (const csfx_layout_t*)csfx__library_symbol(library, "csfx_layout");
+    if (!layout || layout->count < 0)
+    {
+        return NULL;
+    }
+
+    int    i;
+    size_t size = sizeof(csfx_layout_t) + sizeof(csfx_field_t) * layout->count;
+    for (i = 0; i < layout->count; i++)
+    {
+        size += strlen(layout->fields[i].name) + 1;
+    }
+
+    csfx_layout_t* clone = (csfx_layout_t*)malloc(size);
+    if (clone)
+    {
+        csfx_field_t* fields = (csfx_field_t*)(clone + 1);
+        char*         names  = (char*)(fields + layout->count);
+
+        *clone        = *layout;
+        clone->fields = fields;
+        for (i = 0; i < layout->count; i++)
+        {
+            size_t len = strlen(layout->fields[i].name) + 1;
+            fields[i]      = layout->fields[i];
+            fields[i].name = (const char*)memcpy(names, layout->fields[i].name, len);
+            names += len;
+        }
+    }
+    return clone;
+}
+
+/* Migrate state from the old layout to the layout of the new library, return new state */
+static void* csfx__layout_reload(csfx_arena_t* arena, const csfx_layout_t* old, void* library, void* userdata)
+{
+    const csfx_layout_t* layout = (const csfx_layout_t*)csfx__library_symbol(library, "csfx_layout");
+    if (!old || !layout || !userdata || (old->version == layout->version && old->size == layout->size))
+    {
+        return userdata;
+    }
+
+    if (!csfx__arena_owns(arena, userdata))
+    {
+        return userdata; /* Size of state is unknown, let script handle it */
+    }
+
+    void* state = csfx__arena_alloc(arena, layout->size);
+    if (state)
+    {
+        csfx_layout_migrate(layout, state, old, userdata, 1);
+    }
+    csfx__arena_free(arena, userdata);
+    return state; /* NULL when out of arena, script rebuild its state */
+}
+
+/* Live objects are always re-seated, regions are scanned for stale pointers in debug:
+ * registered ones and used part of arena */
+static void* csfx__stale_unload(csfx__script_data_t* data, csfx_arena_t* arena, void* library)
+{
+    if (!CSFX_STALE_SCAN)
+    {
+        return arena->live ? csfx__stale_collect(library, arena->live, NULL, 0) : NULL;
+    }
+
+    csfx__region_t  local[1];
+    csfx__region_t* regions = local;
+    int             count   = data ? data->regioncount + 1 : 1;
+    if (data && data->regioncount > 0)
+    {
+        regions = (csfx__region_t*)malloc(sizeof(csfx__region_t) * count);
+        if (!regions)
+        {
+            return NULL;
+        }
+        memcpy(regions + 1, data->regions, sizeof(csfx__region_t) * data->regioncount);
+    }
+
+    regions[0].ptr  = arena->base;
+    regions[0].size = arena->top;
+
+    void* stale = csfx__stale_collect(library, arena->live, regions, count);
+    if (regions != local)
+    {
+        free(regions);
+    }
+    return stale;
+}
+
+static int csfx__call_main(csfx_script_t* script, void* library, int state)
+{
+    typedef void* (*csfx_main_f)(void*, int, int);
+
+    const char* name = "csfx_main";
+    csfx_main_f func = (csfx_main_f)csfx__library_symbol(library, name);
+
+    csfx__script_data_t* data = *(csfx__script_data_t**)(&script->internal);
+    csfx__arena_bind(&data->arena, library);
+
+    if (func)
+    {
+        csfx_try (script)
+        {
+            script->userdata = func(script->userdata, script->state, state);
+        }
+        csfx_except (script)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/** Snapshot: arena image in a file, mapped back at same address on restore **/
+#if !defined(_WIN32)
+
+#define CSFX__SNAPSHOT_MAGIC "CSFXSNP2"
+
+/* Image start at CSFX_ARENA_COMMIT in file, so it can be mapped directly */
+typedef struct
+{
+    char               magic[8];
+    unsigned long long base;
+    unsigned long long top;
+    unsigned long long committed;
+    unsigned long long reserved;
+    unsigned long long used;
+    unsigned long long limit;
+    long long          userdata;      /* Offsets from base, -1 is NULL */
+    long long          live;
+    long long          freelists[64];
+    long long          fixups;        /* Stale pointers, after image */
+    long long          fields;        /* Layout fields, after fixups, -1 when no layout */
+    long long          layoutversion;
+    long long          layoutsize;
+} csfx__snapshot_t;
+
+static long long csfx__snapshot_offset(const csfx_arena_t* arena, const void* ptr)
+{
+    return ptr ? (long long)((const char*)ptr - arena->base) : -1;
+}
+
+static void* csfx__snapshot_pointer(const csfx_arena_t* arena, long long offset)
+{
+    return offset >= 0 && (unsigned long long)offset < arena->top ? arena->base + offset : NULL;
+}
+
+static int csfx__snapshot_write_string(FILE* file, const char* str)
+{
+    unsigned int len = str ? (unsigned int)strlen(str) : 0;
+    return fwrite(&len, sizeof(len), 1, file) == 1 && fwrite(str ? str : "", 1, len, file) == len;
+}
+
+static char* csfx__snapshot_read_string(FILE* file)
+{
+    unsigned int len;
+    if (fread(&len, sizeof(len), 1, file) != 1 || len >= CSFX__MAX_FAULTMSG)
+    {
+        return NULL;
+    }
+
+    char* str = (char*)malloc(len + 1);
+    if (str && fread(str, 1, len, file) != len)
+    {
+        free(str);
+        return NULL;
+    }
+    if (str)
+    {
+        str[len] = 0;
+    }
+    return str;
+}
+
+static int csfx__snapshot_save(csfx__script_data_t* data, void* userdata, const char* path)
+{
+    csfx_arena_t* arena = &data->arena;
+    if (data->isolate || (userdata && !csfx__arena_owns(arena, userdata)))
+    {
+        return -1;
+    }
+
+    /* Write aside then rename, a restored arena may still map the old file */
+    char tmppath[CSFX__MAX_PATH];
+    if (snprintf(tmppath, sizeof(tmppath), "%s.tmp", path) >= (int)sizeof(tmppath))
+    {
+        return -1;
+    }
+
+    FILE* file = fopen(tmppath, "wb");
+    if (!file)
+    {
+        return -1;
+    }
+
+    /* Pointers into script are saved as symbol and offset */
+    csfx__stales_t* stales = NULL;
+    if (data->library && arena->base)
+    {
+        csfx__region_t region;
+        region.ptr  = arena->base;
+        region.size = arena->top;
+        stales = (csfx__stales_t*)csfx__stale_collect(data->library, arena->live, &region, 1);
+    }
+    csfx_layout_t* layout = data->library ? csfx__layout_clone(data->library) : NULL;
+
+    csfx__snapshot_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CSFX__SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.base          = (unsigned long long)(size_t)arena->base;
+    header.top           = arena->top;
+    header.committed     = arena->committed;
+    header.reserved      = arena->reserved;
+    header.used          = arena->used;
+    header.limit         = arena->limit;
+    header.userdata      = csfx__snapshot_offset(arena, userdata);
+    header.live          = csfx__snapshot_offset(arena, arena->live);
+    header.fixups        = stales ? stales->count : 0;
+    header.fields        = layout ? layout->count : -1;
+    header.layoutversion = layout ? layout->version : 0;
+    header.layoutsize    = layout ? layout->size : 0;
+
+    int idx;
+    for (idx = 0; idx < 64; idx++)
+    {
+        header.freelists[idx] = csfx__snapshot_offset(arena, arena->freelists[idx]);
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fseek(file, CSFX_ARENA_COMMIT, SEEK_SET) == 0
+        && fwrite(arena->base, 1, arena->top, file) == arena->top
+        && fseek(file, (long)(CSFX_ARENA_COMMIT + arena->committed), SEEK_SET) == 0;
+
+    for (idx = 0; ok && idx < header.fixups; idx++)
+    {
+        const csfx__stale_t* stale = &stales->items[idx];
+        long long fixup[3];
+        fixup[0] = csfx__snapshot_offset(arena, stale->where);
+        fixup[1] = (long long)stale->offset;
+        fixup[2] = (long long)(size_t)stale->value;
+        ok = fwrite(fixup, sizeof(fixup), 1, file) == 1 && csfx__snapshot_write_string(file, stale->name);
+    }
+
+    for (idx = 0; ok && idx < header.fields; idx++)
+    {
+        const csfx_field_t* field = &layout->fields[idx];
+        unsigned int desc[3];
+        desc[0] = (unsigned int)field->type;
+        desc[1] = field->offset;
+        desc[2] = field->size;
+        ok = fwrite(desc, sizeof(desc), 1, file) == 1 && csfx__snapshot_write_string(file, field->name);
+    }
+
+    /* Seek alone does not grow the file, and the whole committed range is mapped on restore */
+    struct stat st;
+    ok = fflush(file) == 0 && ok;
+    ok = ok && fstat(fileno(file), &st) == 0
+        && ((unsigned long long)st.st_size >= CSFX_ARENA_COMMIT + arena->committed
+            || ftruncate(fileno(file), (off_t)(CSFX_ARENA_COMMIT + arena->committed)) == 0);
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmppath, path) == 0;
+    if (!ok)
+    {
+        unlink(tmppath);
+    }
+
+    csfx__stale_apply(stales, NULL, NULL, 0);
+    free(layout);
+    return ok ? 0 : -1;
+}
+
+/* Fields and names are in one block, like csfx__layout_clone */
+static csfx_layout_t* csfx__snapshot_read_layout(FILE* file, const csfx__snapshot_t* header)
+{
+    if (header->fields < 0 || header->fields > 65536)
+    {
+        return NULL;
+    }
+
+    int           count  = (int)header->fields;
+    csfx_field_t* fields = (csfx_field_t*)calloc(count + 1, sizeof(csfx_field_t));
+    size_t        names  = 0;
+
+    int idx;
+    for (idx = 0; fields && idx < count; idx++)
+    {
+        unsigned int desc[3];
+        char*        name;
+        if (fread(desc, sizeof(desc), 1, file) != 1 || !(name = csfx__snapshot_read_string(file)))
+        {
+            break;
+        }
+
+        fields[idx].name   = name;
+        fields[idx].type   = (int)desc[0];
+        fields[idx].offset = desc[1];
+        fields[idx].size   = desc[2];
+        names += strlen(name) + 1;
+    }
+    count = idx;
+
+    csfx_layout_t* layout = fields
+        ? (csfx_layout_t*)malloc(sizeof(csfx_layout_t) + sizeof(csfx_field_t) * count + names)
+        : NULL;
+    if (layout)
+    {
+        csfx_field_t* dst  = (csfx_field_t*)(layout + 1);
+        char*         name = (char*)(dst + count);
+
+        layout->version = (int)header->layoutversion;
+        layout->size    = (unsigned)header->layoutsize;
+        layout->count   = count;
+        layout->fields  = dst;
+        for (idx = 0; idx < count; idx++)
+        {
+            dst[idx]      = fields[idx];
+            dst[idx].name = strcpy(name, fields[idx].name);
+            name += strlen(name) + 1;
+        }
+    }
+
+    for (idx = 0; fields && idx < count; idx++)
+    {
+        free((char*)fields[idx].name);
+    }
+    free(fields);
+    return layout;
+}
+
+static int csfx__snapshot_load(csfx__script_data_t* data, void** userdata, const char* path)
+{
+    csfx_arena_t* arena = &data->arena;
+    if (data->isolate || arena->base)
+    {
+        return -1;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+
+    /* Image is mapped from file, a short file would fault on first access */
+    struct stat      st;
+    csfx__snapshot_t header;
+    long             page = sysconf(_SC_PAGESIZE);
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, CSFX__SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+        || header.top > header.committed || header.committed > header.reserved
+        || header.used > header.top
+        || header.base % page || header.committed % page || header.reserved % page
+        || CSFX_ARENA_COMMIT % page || header.fixups < 0
+        || fstat(fileno(file), &st) != 0
+        || (unsigned long long)st.st_size < CSFX_ARENA_COMMIT + header.committed)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    /* Only at old address: pointers inside the image are not known, a moved one would dangle */
+    char* want = (char*)(size_t)header.base;
+    char* base = NULL;
+    if (header.reserved)
+    {
+#if defined(MAP_FIXED_NOREPLACE)
+        base = (char*)mmap(want, header.reserved, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+        if (base == (char*)MAP_FAILED)
+#endif
+        base = (char*)mmap(want, header.reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    if (base == (char*)MAP_FAILED || base != want
+        || (header.committed && mmap(base, header.committed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                                     fileno(file), CSFX_ARENA_COMMIT) == MAP_FAILED))
+    {
+        if (base && base != (char*)MAP_FAILED)
+        {
+            munmap(base, header.reserved);
+        }
+        fclose(file);
+        return -1;
+    }
+
+    arena->base      = base;
+    arena->top       = header.top;
+    arena->committed = header.committed;
+    arena->reserved  = header.reserved;
+    arena->used      = header.used;
+    arena->limit     = header.limit;
+
+    arena->live = (csfx_live_t*)csfx__snapshot_pointer(arena, header.live);
+
+    int idx;
+    for (idx = 0; idx < 64; idx++)
+    {
+        arena->freelists[idx] = csfx__snapshot_pointer(arena, header.freelists[idx]);
+    }
+
+    /* Stale pointers are fixed when library is loaded */
+    fseek(file, (long)(CSFX_ARENA_COMMIT + header.committed), SEEK_SET);
+    csfx__stales_t* stales = (csfx__stales_t*)calloc(1, sizeof(csfx__stales_t));
+    for (idx = 0; stales && idx < header.fixups; idx++)
+    {
+        long long      fixup[3];
+        csfx__stale_t* stale;
+        if (fread(fixup, sizeof(fixup), 1, file) != 1 || !(stale = csfx__stale_push(stales)))
+        {
+            break;
+        }
+
+        stale->where  = (void**)csfx__snapshot_pointer(arena, fixup[0]);
+        stale->offset = (size_t)fixup[1];
+        stale->value  = (void*)(size_t)fixup[2];
+        stale->name   = csfx__snapshot_read_string(file);
+        if (stale->name && !stale->name[0])
+        {
+            free(stale->name);
+            stale->name = NULL;
+        }
+
+        if (!stale->where)
+        {
+            free(stale->name);
+            stales->count--;
+        }
+    }
+
+    data->stale  = stales;
+    data->layout = csfx__snapshot_read_layout(file, &header);
+    *userdata    = csfx__snapshot_pointer(arena, header.userdata);
+
+    fclose(file);
+    return 0;
+}
+
+#else
+static int csfx__snapshot_save(csfx__script_data_t* data, void* userdata, const char* path)
+{
+    (void)data;
+    (void)userdata;
+    (void)path;
+    return -1;
+}
+
+static int csfx__snapshot_load(csfx__script_data_t* data, void** userdata, const char* path)
+{
+    (void)data;
+    (void)userdata;
+    (void)path;
+    return -1;
+}
+#endif
+
+/** Isolation mode: script run in a child worker process **/
+#if defined(__linux__)
+# include <spawn.h>
+# include <sys/wait.h>
+# include <sys/prctl.h>
+# include <linux/futex.h>
+extern char** environ;
+
+/* Number of request slots of the shared memory ring */
+# ifndef CSFX_ISOLATE_SLOTS
+# define CSFX_ISOLATE_SLOTS 16
+# endif
+
+/* Maximum size of input and output of an invoke through the ring */
+# ifndef CSFX_ISOLATE_DATA
+# define CSFX_ISOLATE_DATA 4096
+# endif
+
+/* Busy wait iterations before sleep on futex, keep round-trips short */
+# ifndef CSFX_ISOLATE_SPIN
+# define CSFX_ISOLATE_SPIN 4096
+# endif
+
+/* Milliseconds the host waits for a load or a request before the child is killed, 0 to wait forever */
+# ifndef CSFX_ISOLATE_TIMEOUT
+# define CSFX_ISOLATE_TIMEOUT 10000
+# endif
+
+/* Program run as child, it serves the ring from a constructor of the CSFX_IMPL unit before main.
+ * Set it to a helper program built with CSFX_IMPL when the host cannot be started again */
+# ifndef CSFX_ISOLATE_HELPER
+# define CSFX_ISOLATE_HELPER "/proc/self/exe"
+# endif
+
+/* Descriptor of the ring in child, named by environment variable CSFX_ISOLATE */
+# define CSFX__ISOLATE_FD 3
+
+/* Ring slot states */
+enum
+{
+    CSFX__SLOT_FREE,
+    CSFX__SLOT_CLAIMED,
+    CSFX__SLOT_REQUEST,
+    CSFX__SLOT_DONE,
+};
+
+/* Ring operations */
+enum
+{
+    CSFX__OP_INVOKE,
+    CSFX__OP_RELOAD,
+    CSFX__OP_QUIT,
+};
+
+typedef struct
+{
+    volatile int state; /* Futex word */
+    int          op;
+    int          result;
+    int          errcode;
+    int          inlen;
+    int          outcap;
+    char         name[CSFX__MAX_PATH];
+    char         input[CSFX_ISOLATE_DATA];
+    char         output[CSFX_ISOLATE_DATA];
+} csfx__slot_t;
+
+typedef struct
+{
+    volatile int    ready; /* Futex word, set by child after loaded */
+    volatile int    head;  /* Next slot reserved by host            */
+    int             host;  /* Child exits when it is not its parent */
+    int             state; /* Event of first load                   */
+    volatile size_t used;  /* Arena of child, published after loads and requests */
+    volatile size_t limit; /* Budget of arena of child, set by host before them  */
+    char            libpath[CSFX__MAX_PATH];
+    csfx__slot_t    slots[CSFX_ISOLATE_SLOTS];
+} csfx__ring_t;
+
+typedef struct
+{
+    csfx__ring_t* ring;
+    int           ringfd;  /* Shared memory of ring, mapped by child */
+    volatile int  pid;     /* 0 when child is not running */
+    int           errcode; /* Why the child exited        */
+    csfx_arena_t* arena;   /* Arena of script in host, mirror of the one in child */
+} csfx__isolate_t;
+
+static void csfx__futex_wait(volatile int* addr, int value, long timeout_ns)
+{
+    struct timespec ts;
+    ts.tv_sec  = timeout_ns / 1000000000L;
+    ts.tv_nsec = timeout_ns % 1000000000L;
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+static void csfx__futex_wake(volatile int* addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void csfx__cpu_relax(void)
+{
+# if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+# elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+# endif
+}
+
+/* Reap the child if it has exited, return 0 when the child is gone */
+static int csfx__isolate_alive(csfx__isolate_t* iso)
+{
+    int pid = iso->pid;
+    if (pid == 0)
+    {
+        return 0;
+    }
+
+    int status;
+    int res = waitpid(pid, &status, WNOHANG);
+    if (res == 0)
+    {
+        return 1;
+    }
+
+    if (__sync_bool_compare_and_swap(&iso->pid, pid, 0))
+    {
+        if (res == pid && WIFSIGNALED(status))
+        {
+            iso->errcode = csfx__signal_errcode(WTERMSIG(status), NULL);
+        }
+        else
+        {
+            iso->errcode = CSFX_ERROR_ABORT;
+        }
+    }
+    return 0;
+}
+
+/* Spinning only help when the other side run on another cpu */
+static int csfx__isolate_spin(void)
+{
+    static int spin = -1;
+    if (spin < 0)
+    {
+        spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? CSFX_ISOLATE_SPIN : 0;
+    }
+    return spin;
+}
+
+/* Kill a child that does not respond, its pending requests fail with CSFX_ERROR_TIMEOUT */
+static void csfx__isolate_kill(csfx__isolate_t* iso)
+{
+    int pid = iso->pid;
+    if (pid != 0 && __sync_bool_compare_and_swap(&iso->pid, pid, 0))
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        iso->errcode = CSFX_ERROR_TIMEOUT;
+    }
+}
+
+/* Spin, then sleep on futex, until *addr leaves value, child died, or CSFX_ISOLATE_TIMEOUT passed */
+static int csfx__isolate_wait(csfx__isolate_t* iso, volatile int* addr, int value)
+{
+    int spin;
+    int maxspin = csfx__isolate_spin();
+    for (spin = 0; spin < maxspin; spin++)
+    {
+        if (*addr != value)
+        {
+            return 0;
+        }
+        csfx__cpu_relax();
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (*addr == value)
+    {
+        if (!csfx__isolate_alive(iso))
+        {
+            return -1;
+        }
+        csfx__futex_wait(addr, value, 10 * 1000 * 1000);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsed = (now.tv_sec - start.tv_sec) * 1000LL + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (CSFX_ISOLATE_TIMEOUT > 0 && elapsed >= CSFX_ISOLATE_TIMEOUT && *addr == value)
+        {
+            csfx__isolate_kill(iso);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Child side: wait for requests in order, until quit */
+static void csfx__isolate_child(csfx__ring_t* ring)
+{
+    typedef void* (*csfx_main_f)(void*, int, int);
+
+    int           state = ring->state;
+    csfx_arena_t  arenadata;
+    csfx_arena_t* arena = &arenadata;
+    csfx__arena_init(arena);
+
+    /* Faults of script kill the child, they never jump into host frames */
+    int idx;
+    for (idx = 0; idx < (int)csfx__countof(csfx__signals); idx++)
+    {
+        signal(csfx__signals[idx], SIG_DFL);
+    }
+    signal(CSFX_TIMEOUT_SIGNAL, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != ring->host)
+    {
+        _exit(1);
+    }
+
+    void*       userdata = NULL;
+    void*       library  = dlopen(ring->libpath, RTLD_NOW);
+    csfx_main_f entry    = library ? (csfx_main_f)dlsym(library, "csfx_main") : NULL;
+    if (!library)
+    {
+        ring->ready = -1;
+        csfx__futex_wake(&ring->ready);
+        _exit(1);
+    }
+
+    /* Allocations stay in the child, the host reads how much of its budget they use */
+    arena->limit = ring->limit;
+    csfx__arena_bind(arena, library);
+    if (entry)
+    {
+        userdata = entry(userdata, CSFX_NONE, state);
+    }
+    ring->used  = arena->used;
+    ring->ready = 1;
+    csfx__futex_wake(&ring->ready);
+
+    int          maxspin = csfx__isolate_spin();
+    unsigned int tail;
+    for (tail = 0; ; tail++)
+    {
+        csfx__slot_t* slot = &ring->slots[tail % CSFX_ISOLATE_SLOTS];
+        
+        int spin = 0;
+        int cur;
+        while ((cur = slot->state) != CSFX__SLOT_REQUEST)
+        {
+            if (spin < maxspin)
+            {
+                csfx__cpu_relax();
+                spin++;
+            }
+            else
+            {
+                csfx__futex_wait(&slot->state, cur, 1000 * 1000 * 1000);
+            }
+        }
+        __sync_synchronize();
+        arena->limit = ring->limit;
+
+        switch (slot->op)
+        {
+        case CSFX__OP_INVOKE:
+        {
+            csfx_invoke_f func = (csfx_invoke_f)dlsym(library, slot->name);
+            if (func)
+            {
+                slot->result  = func(userdata, slot->input, slot->inlen, slot->output, slot->outcap);
+                slot->errcode = CSFX_ERROR_NONE;
+            }
+            else
+            {
+                slot->result  = -1;
+                slot->errcode = CSFX_ERROR_SYSCALL;
+            }
+            break;
+        }
+            
+        case CSFX__OP_RELOAD:
+        {
+            void* newlib = dlopen(slot->name, RTLD_NOW);
+            if (newlib)
+            {
+                csfx_layout_t* oldlayout;
+                void*          oldglobals;
+                void*          oldstale;
+                if (entry) userdata = entry(userdata, state, CSFX_UNLOAD);
+                oldlayout   = csfx__layout_clone(library);
+                oldglobals  = csfx__globals_save(library);
+                oldstale    = csfx__stale_unload(NULL, arena, library);
+                dlclose(library);
+                
+                state   = CSFX_RELOAD;
+                library = newlib;
+                entry   = (csfx_main_f)dlsym(library, "csfx_main");
+                csfx__arena_bind(arena, library);
+                csfx__globals_load(oldglobals, library);
+                csfx__stale_apply(oldstale, library, NULL, 0);
+                userdata = csfx__layout_reload(arena, oldlayout, library, userdata);
+                free(oldlayout);
+                if (entry) userdata = entry(userdata, CSFX_UNLOAD, state);
+                slot->result = 0;
+            }
+            else
+            {
+                slot->result = -1;
+            }
+            slot->errcode = CSFX_ERROR_NONE;
+            break;
+        }
+
+        case CSFX__OP_QUIT:
+        default:
+            if (entry) userdata = entry(userdata, state, CSFX_QUIT);
+            slot->result  = 0;
+            slot->errcode = CSFX_ERROR_NONE;
+            __sync_synchronize();
+            slot->state = CSFX__SLOT_DONE;
+            csfx__futex_wake(&slot->state);
+            _exit(0);
+        }
+
+        ring->used = arena->used;
+        __sync_synchronize();
+        slot->state = CSFX__SLOT_DONE;
+        csfx__futex_wake(&slot->state);
+    }
+}
+
+/* Child started by csfx__isolate_spawn is this program again, it never returns to main */
+__attribute__((constructor(101))) static void csfx__isolate_main(void)
+{
+    const char* env = getenv("CSFX_ISOLATE");
+    if (!env)
+    {
+        return;
+    }
+
+    int   fd   = atoi(env);
+    void* ring = mmap(NULL, sizeof(csfx__ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    unsetenv("CSFX_ISOLATE");
+    if (ring == MAP_FAILED)
+    {
+        _exit(1);
+    }
+    close(fd);
+    csfx__isolate_child((csfx__ring_t*)ring);
+    _exit(0);
+}
+
+/* Start a fresh child by CSFX_ISOLATE_HELPER, the ring is reset.
+ * It is spawned, never forked: the host may run other threads, and the child loads libraries */
+static int csfx__isolate_spawn(csfx__isolate_t* iso, const char* libpath, int state)
+{
+    memset(iso->ring, 0, sizeof(csfx__ring_t));
+    iso->errcode     = CSFX_ERROR_NONE;
+    iso->ring->host  = (int)getpid();
+    iso->ring->state = state;
+    iso->ring->limit = iso->arena->limit;
+    snprintf(iso->ring->libpath, sizeof(iso->ring->libpath), "%s", libpath);
+
+    /* Environment of host, with the ring descriptor */
+    int count = 0;
+    while (environ[count])
+    {
+        count++;
+    }
+    char** envp = (char**)malloc((count + 2) * sizeof(char*));
+    if (!envp)
+    {
+        return -1;
+    }
+    char ringenv[32];
+    snprintf(ringenv, sizeof(ringenv), "CSFX_ISOLATE=%d", CSFX__ISOLATE_FD);
+    int envc = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (strncmp(environ[i], "CSFX_ISOLATE=", 13) != 0)
+        {
+            envp[envc++] = environ[i];
+        }
+    }
+    envp[envc++] = ringenv;
+    envp[envc]   = NULL;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, iso->ringfd, CSFX__ISOLATE_FD);
+
+    pid_t pid;
+    char* argv[] = { (char*)"csfx-isolate", NULL };
+    int   res    = posix_spawn(&pid, CSFX_ISOLATE_HELPER, &actions, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    free(envp);
+    if (res != 0)
+    {
+        return -1;
+    }
+
+    iso->pid = pid;
+    if (csfx__isolate_wait(iso, &iso->ring->ready, 0) != 0 || iso->ring->ready != 1)
+    {
+        if (iso->pid)
+        {
+            kill(iso->pid, SIGKILL);
+            waitpid(iso->pid, NULL, 0);
+            iso->pid = 0;
+        }
+        return -1;
+    }
+    iso->arena->used = iso->ring->used;
+    return 0;
+}
+
+/* Host side: reserve a slot, publish request, wait for response */
+static int csfx__isolate_request(csfx__isolate_t* iso, int op, const char* name,
+                                 const void* input, int inlen, void* output, int outcap,
+                                 int* errcode)
+{
+    csfx__ring_t* ring = iso->ring;
+
+    if (inlen > CSFX_ISOLATE_DATA || !iso->pid)
+    {
+        *errcode = iso->pid ? CSFX_ERROR_OUTBOUNDS : iso->errcode;
+        return -1;
+    }
+
+    /* Slots are claimed exclusively, many host threads can share the ring */
+    unsigned int  idx  = (unsigned int)__sync_fetch_and_add(&ring->head, 1);
+    csfx__slot_t* slot = &ring->slots[idx % CSFX_ISOLATE_SLOTS];
+    while (!__sync_bool_compare_and_swap(&slot->state, CSFX__SLOT_FREE, CSFX__SLOT_CLAIMED))
+    {
+        int cur = slot->state;
+        if (cur != CSFX__SLOT_FREE && csfx__isolate_wait(iso, &slot->state, cur) != 0)
+        {
+            *errcode = iso->errcode;
+            return -1;
+        }
+    }
+
+    ring->limit  = iso->arena->limit;
+    slot->op     = op;
+    slot->inlen  = inlen;
+    slot->outcap = outcap < CSFX_ISOLATE_DATA ? outcap : CSFX_ISOLATE_DATA;
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    if (inlen > 0)
+    {
+        memcpy(slot->input, input, inlen);
+    }
+    
+    __sync_synchronize();
+    slot->state = CSFX__SLOT_REQUEST;
+    csfx__futex_wake(&slot->state);
+
+    if (csfx__isolate_wait(iso, &slot->state, CSFX__SLOT_REQUEST) != 0)
+    {
+        *errcode = iso->errcode;
+        return -1;
+    }
+    __sync_synchronize();
+
+    int result = slot->result;
+    *errcode   = slot->errcode;
+    iso->arena->used = ring->used;
+    if (result > 0 && output)
+    {
+        memcpy(output, slot->output, result < outcap ? result : outcap);
+    }
+
+    slot->state = CSFX__SLOT_FREE;
+    csfx__futex_wake(&slot->state);
+    return result;
+}
+
+/* Ring is shared memory with a descriptor, so a spawned child can map it */
+static int csfx__isolate_create(csfx__script_data_t* data)
+{
+    csfx__isolate_t* iso  = (csfx__isolate_t*)malloc(sizeof(csfx__isolate_t));
+    int              fd   = (int)syscall(SYS_memfd_create, "csfx-ring", 1U /* MFD_CLOEXEC */);
+    void*            ring = MAP_FAILED;
+    if (fd == CSFX__ISOLATE_FD)
+    {
+        /* dup2 onto itself would keep close-on-exec */
+        int moved = fcntl(fd, F_DUPFD_CLOEXEC, CSFX__ISOLATE_FD + 1);
+        close(fd);
+        fd = moved;
+    }
+    if (fd >= 0 && ftruncate(fd, sizeof(csfx__ring_t)) == 0)
+    {
+        ring = mmap(NULL, sizeof(csfx__ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (!iso || ring == MAP_FAILED)
+    {
+        free(iso);
+        if (fd >= 0) close(fd);
+        if (ring != MAP_FAILED) munmap(ring, sizeof(csfx__ring_t));
+        return -1;
+    }
+
+    iso->ring     = (csfx__ring_t*)ring;
+    iso->ringfd   = fd;
+    iso->pid      = 0;
+    iso->errcode  = CSFX_ERROR_NONE;
+    iso->arena    = &data->arena;
+    data->isolate = iso;
+    return 0;
+}
+
+static void csfx__isolate_free(csfx_script_t* script)
+{
+    csfx__script_data_t* data = *(csfx__script_data_t**)(&script->internal);
+    csfx__isolate_t*     iso  = (csfx__isolate_t*)data->isolate;
+
+    if (iso->pid)
+    {
+        int errcode;
+        script->state = CSFX_QUIT;
+        csfx__isolate_request(iso, CSFX__OP_QUIT, "", NULL, 0, NULL, 0, &errcode);
+        if (iso->pid)
+        {
+            waitpid(iso->pid, NULL, 0);
+        }
+        csfx__remove_file(data->libtpath);
+    }
+    
+    munmap(iso->ring, sizeof(csfx__ring_t));
+    close(iso->ringfd);
+    free(iso);
+    data->isolate = NULL;
+}
+
+static int csfx__isolate_update(csfx_script_t* script)
+{
+    csfx__script_data_t* data = *(csfx__script_data_t**)(&script->internal);
+    csfx__isolate_t*     iso  = (csfx__isolate_t*)data->isolate;
+
+    /* Child crashed, report once, then restart it with a fresh state */
+    int crashed = !csfx__isolate_alive(iso) && iso->errcode != CSFX_ERROR_NONE;
+    if (crashed && script->state != CSFX_FAILED)
+    {
+        script->errcode = iso->errcode;
+        script->state   = CSFX_FAILED;
+        return script->state;
+    }
+
+    int changed = csfx__script_changed(script);
+    if (!iso->pid && (changed || crashed))
+    {
+        /* Wait for next change when the library cannot be loaded */
+        data->libtime = csfx__file_stamp(data->librpath);
+        
+        csfx__remove_file(data->libtpath);
+        if (!csfx__copy_file(data->librpath, data->libtpath)
+            || csfx__isolate_spawn(iso, data->libtpath, CSFX_INIT) != 0)
+        {
+            script->state = CSFX_FAILED;
+            return script->state;
+        }
+
+        script->errcode = CSFX_ERROR_NONE;
+        script->state   = CSFX_INIT;
+        return script->state;
+    }
+    else if (iso->pid && changed)
+    {
+        /* New version get a new shadow path, the child still maps the old one */
+        char libtpath[CSFX__MAX_PATH];
+        int  errcode = CSFX_ERROR_NONE;
+        if (csfx__get_temp_path(data->librpath, libtpath, CSFX__MAX_PATH) < 0
+            || !csfx__copy_file(data->librpath, libtpath)
+            || csfx__isolate_request(iso, CSFX__OP_RELOAD, libtpath, NULL, 0, NULL, 0, &errcode) != 0)
+        {
+            csfx__remove_file(libtpath);
+            script->errcode = errcode;
+            script->state   = CSFX_FAILED;
+            return script->state;
+        }
+
+        csfx__remove_file(data->libtpath);
+        memcpy(data->libtpath, libtpath, CSFX__MAX_PATH);
+        data->libtime   = csfx__file_stamp(data->librpath);
+        script->errcode = CSFX_ERROR_NONE;
+        script->state   = CSFX_RELOAD;
+        return script->state;
+    }
+
+    if (script->state != CSFX_FAILED)
+    {
+        script->state = CSFX_NONE;
+    }
+    return CSFX_NONE;
+}
+
+static int csfx__isolate_invoke(csfx_script_t* script, const char* name,
+                                const void* input, int inlen, void* output, int outcap)
+{
+    csfx__script_data_t* data = *(csfx__script_data_t**)(&script->internal);
+    csfx__isolate_t*     iso  = (csfx__isolate_t*)data->isolate;
+
+    int errcode = CSFX_ERROR_NONE;
+    int result  = csfx__isolate_request(iso, CSFX__OP_INVOKE, name,
+                                        input, inlen, output, outcap, &errcode);
+    if (errcode != CSFX_ERROR_NONE)
+    {
+        script->errcode = errcode;
+    }
+    return result;
+}
+
+/* Arena of isolated script is in the child, used bytes are the last ones it published */
+static void csfx__isolate_arena(csfx__script_data_t* data)
+{
+    csfx__isolate_t* iso = (csfx__isolate_t*)data->isolate;
+    if (iso && iso->pid)
+    {
+        data->arena.used = iso->ring->used;
+    }
+}
+#else
+static int csfx__isolate_create(csfx__script_data_t* data)
+{
+    (void)data;
+    return -1;
+}
+
+static void csfx__isolate_arena(csfx__script_data_t* data)
+{
+    (void)data;
+}
+
+static void csfx__isolate_free(csfx_script_t* script)
+{
+    (void)script;
+}
+
+static int csfx__isolate_update(csfx_script_t* script)
+{
+    return script->state;
+}
+
+static int csfx__isolate_invoke(csfx_script_t* script, const char* name,
+                                const void* input, int inlen, void* output, int outcap)
+{
+    (void)script; (void)name; (void)input; (void)inlen; (void)output; (void)outcap;
+    return -1;
+}
+#endif /* __linux__ */
+
+/** Build stage: compilers of script run in background, their output parsed into diagnostics **/
+#if !defined(_WIN32)
+# include <errno.h>
+# include <spawn.h>
+# include <sys/wait.h>
+extern char** environ;
+#endif
+#if defined(__linux__)
+# include <poll.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+
+/* Maximum number of compilers run at once by all scripts, 0 for number of cores */
+#ifndef CSFX_BUILD_JOBS
+#define CSFX_BUILD_JOBS 0
+#endif
+
+typedef struct
+{
+    char*  text;
+    size_t len;
+    size_t cap;
+} csfx__log_t;
+
+typedef struct
+{
+#if defined(_WIN32)
+    HANDLE      process;
+    HANDLE      pipe;
+#else
+    pid_t       pid;
+    int         pipe;
+#endif
+    int         unit;     /* Index of compiled unit, -1 for link */
+    csfx__log_t log;
+} csfx__job_t;
+
+typedef struct
+{
+    char* source;
+    char* object;         /* Source with .o extension, its make rule in .d file */
+    int   changed;        /* Compiled or restored by running build */
+} csfx__unit_t;
+
+typedef struct
+{
+    char*              compile;   /* Command of each unit, {src} and {obj} replaced */
+    char*              link;      /* Command of library, {objs} and {out} replaced */
+    char*              libpath;
+    csfx__unit_t*      units;
+    int                unitcount; /* 0 when link is the only command */
+    char*              tier;      /* Optimized build started after this one, {out} replaced */
+    char*              tierpath;  /* Output of optimized build, moved over library when done */
+    char*              patch;     /* Command of patch from changed objects, {objs}, {out} and {base} replaced */
+    char               patchpath[CSFX__MAX_PATH]; /* Output of patch, then of library relinked after it */
+    void*              library;   /* Loaded version of library, patched in place */
+
+    int                running;
+    int                again;     /* Requested while running, start after it */
+    int                next;      /* Next unit to check */
+    int                compiled;
+    int                failed;
+    int                linking;
+    int                tiering;   /* Running build is the optimized one */
+    int                patching;  /* Linking patch of running build */
+    int                patched;   /* 1 when patch applied, -1 when it cannot, library is relinked after */
+    int                waiting;   /* Patch accepted, written once no guarded call runs in library */
+    int                precompiled; /* Precompiled header checked, -1 while its command is run by this build */
+    int                cached;    /* Linked library is stored in cache, with libkey */
+    unsigned long long libkey;
+    csfx__job_t*       jobs;
+    int                jobcount;
+
+    csfx__log_t        log;       /* Output of running build */
+    char*              output;    /* Output of last completed build */
+    csfx_diagnostic_t* diags;
+    int                diagcount;
+} csfx__build_t;
+
+/* Tokens of compilers, shared by builds of all scripts like a jobserver */
+static volatile long csfx__build_tokens;
+
+/* Loaded patches stay mapped, each one need a new path */
+static int csfx__build_patches;
+
+static int csfx__build_token_take(void)
+{
+    long limit = CSFX_BUILD_JOBS;
+    if (limit <= 0)
+    {
+    #if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        limit = (long)info.dwNumberOfProcessors;
+    #else
+        limit = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+        limit = limit > 0 ? limit : 1;
+    }
+
+#if defined(_MSC_VER)
+    if (InterlockedIncrement(&csfx__build_tokens) > limit)
+    {
+        InterlockedDecrement(&csfx__build_tokens);
+        return 0;
+    }
+#else
+    if (__sync_add_and_fetch(&csfx__build_tokens, 1) > limit)
+    {
+        __sync_sub_and_fetch(&csfx__build_tokens, 1);
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+static void csfx__build_token_give(void)
+{
+#if defined(_MSC_VER)
+    InterlockedDecrement(&csfx__build_tokens);
+#else
+    __sync_sub_and_fetch(&csfx__build_tokens, 1);
+#endif
+}
+
+
+/* Make rule of object, as written by -MMD */
+static int csfx__build_deppath(const char* object, char* path, size_t size)
+{
+    size_t      len = strlen(object);
+    const char* ext = strrchr(object, '.');
+    len = ext ? (size_t)(ext - object) : len;
+    if (len + 3 > size)
+    {
+        return -1;
+    }
+    memcpy(path, object, len);
+    memcpy(path + len, ".d", 3);
+    return 0;
+}
+
+/* Visit prerequisites in make rule of object
+ * @return: 0 on success, -1 without make rule */
+static int csfx__build_deps(const char* object, void (*visit)(void* userdata, const char* path), void* userdata)
+{
+    char path[CSFX__MAX_PATH];
+    if (csfx__build_deppath(object, path, sizeof(path)) != 0)
+    {
+        return -1;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+
+    size_t len;
+
+    /* Skip target, a colon followed by space ends it */
+    int ch, prev = 0;
+    while ((ch = fgetc(file)) != EOF && !(prev == ':' && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')))
+    {
+        prev = ch;
+    }
+
+    len = 0;
+    ch  = ch == '\n' ? EOF : ch;
+    while (ch != EOF)
+    {
+        int literal = 0;
+        ch = fgetc(file);
+        if (ch == '\\')
+        {
+            int next = fgetc(file);
+            if (next == ' ' || next == '#')
+            {
+                ch      = next;
+                literal = 1;
+            }
+            else if (next == '\r' || next == '\n')
+            {
+                if (next == '\r' && (next = fgetc(file)) != '\n')
+                {
+                    ungetc(next, file);
+                }
+                ch = ' ';
+            }
+            else
+            {
+                ungetc(next, file);
+            }
+        }
+
+        int split = !literal && (ch == ' ' || ch == '\t' || ch == '\r');
+        if (!literal && ch == '\n')
+        {
+            ch = EOF;
+        }
+
+        if (ch != EOF && !split)
+        {
+            if (len + 1 < sizeof(path))
+            {
+                path[len++] = (char)ch;
+            }
+        }
+        else if (len > 0)
+        {
+            path[len] = 0;
+            len       = 0;
+            visit(userdata, path);
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static void csfx__build_depstamp_visit(void* userdata, const char* path)
+{
+    long long* stamp = (long long*)userdata;
+    long long  time  = csfx__file_stamp(path);
+    *stamp = time > *stamp ? time : *stamp;
+}
+
+/* Newest stamp of source and headers of object */
+static long long csfx__build_depstamp(const char* object, long long stamp)
+{
+    csfx__build_deps(object, csfx__build_depstamp_visit, &stamp);
+    return stamp;
+}
+
+static char* csfx__strdup(const char* text)
+{
+    size_t size = strlen(text) + 1;
+    char*  copy = (char*)malloc(size);
+    return copy ? (char*)memcpy(copy, text, size) : NULL;
+}
+
+/* Replace {key} of template with values, NULL when out of memory */
+static char* csfx__build_format(const char* format, const char* const* keys, const char* const* values, int count)
+{
+    size_t size = strlen(format) + 1;
+    char*  text = (char*)malloc(size);
+    size_t len  = 0;
+    while (text && *format)
+    {
+        const char* value = NULL;
+        size_t      skip  = 1;
+        for (int i = 0; i < count && *format == '{'; i++)
+        {
+            size_t keylen = strlen(keys[i]);
+            if (strncmp(format + 1, keys[i], keylen) == 0 && format[keylen + 1] == '}')
+            {
+                value = values[i];
+                skip  = keylen + 2;
+                break;
+            }
+        }
+
+        size_t valuelen = value ? strlen(value) : 1;
+        if (len + valuelen + 1 > size)
+        {
+            size = (len + valuelen + 1) * 2;
+            char* grown = (char*)realloc(text, size);
+            if (!grown)
+            {
+                free(text);
+                return NULL;
+            }
+            text = grown;
+        }
+
+        memcpy(text + len, value ? value : format, valuelen);
+        len    += valuelen;
+        format += skip;
+    }
+
+    if (text)
+    {
+        text[len] = 0;
+    }
+    return text;
+}
+
+/* Directory of compile cache, objects and libraries keyed by hash of their inputs. Empty when disabled */
+static char csfx__build_cachedir[CSFX__MAX_PATH];
+
+/* Precompiled header of all builds and its command, see csfx_build_pch. Rebuilt by one build at once */
+static char                    csfx__build_pchheader[CSFX__MAX_PATH];
+static char*                   csfx__build_pchcommand;
+static csfx__build_t* volatile csfx__build_pchowner;
+
+#define CSFX__HASH_SEED 14695981039346656037ULL
+
+/* FNV-1a */
+static unsigned long long csfx__hash(unsigned long long hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Hash path and content of file, a missing file differs from an empty one */
+static unsigned long long csfx__hash_file(unsigned long long hash, const char* path)
+{
+    hash = csfx__hash(hash, path, strlen(path) + 1);
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return csfx__hash(hash, "", 1);
+    }
+
+    char   buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        hash = csfx__hash(hash, buffer, size);
+    }
+    fclose(file);
+    return hash;
+}
+
+static void csfx__hash_file_visit(void* userdata, const char* path)
+{
+    unsigned long long* hash = (unsigned long long*)userdata;
+    *hash = csfx__hash_file(*hash, path);
+}
+
+/* Hash identity of the program which command starts: its path, and time of the file found on PATH */
+static unsigned long long csfx__hash_tool(unsigned long long hash, const char* command)
+{
+    char   name[CSFX__MAX_PATH];
+    char   path[CSFX__MAX_PATH * 2];
+    size_t len = strcspn(command, " \t");
+    if (len == 0 || len >= sizeof(name))
+    {
+        return hash;
+    }
+    memcpy(name, command, len);
+    name[len] = 0;
+
+    long long stamp = 0;
+    if (strchr(name, '/') || strchr(name, '\\'))
+    {
+        snprintf(path, sizeof(path), "%s", name);
+        stamp = csfx__file_stamp(path);
+    }
+
+#if defined(_WIN32)
+    const char* separators = ";";
+    const char* suffix     = ".exe";
+#else
+    const char* separators = ":";
+    const char* suffix     = "";
+#endif
+    const char* dirs = stamp ? NULL : getenv("PATH");
+    while (dirs && *dirs && !stamp)
+    {
+        size_t dirlen = strcspn(dirs, separators);
+        snprintf(path, sizeof(path), "%.*s/%s%s", (int)dirlen, dirs, name, strchr(name, '.') ? "" : suffix);
+        stamp = csfx__file_stamp(path);
+        dirs += dirlen + (dirs[dirlen] != 0);
+    }
+
+    hash = csfx__hash(hash, name, len + 1);
+    return csfx__hash(hash, &stamp, sizeof(stamp));
+}
+
+/* Move file over another, at once for watchers */
+static int csfx__build_move(const char* from, const char* to)
+{
+#if defined(_WIN32)
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(from, to);
+#endif
+}
+
+/* Copy file through a temporary beside destination, it is never seen half written */
+static int csfx__build_copy(const char* from, const char* to)
+{
+    char temp[CSFX__MAX_PATH * 2];
+#if defined(_WIN32)
+    snprintf(temp, sizeof(temp), "%s.%lu", to, (unsigned long)GetCurrentProcessId());
+#else
+    snprintf(temp, sizeof(temp), "%s.%lu", to, (unsigned long)getpid());
+#endif
+
+    FILE* in = fopen(from, "rb");
+    if (!in)
+    {
+        return -1;
+    }
+    FILE* out = fopen(temp, "wb");
+    if (!out)
+    {
+        fclose(in);
+        return -1;
+    }
+
+    char   buffer[8192];
+    size_t size;
+    int    failed = 0;
+    while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        failed |= fwrite(buffer, 1, size, out) != size;
+    }
+    failed |= ferror(in);
+    fclose(in);
+    failed |= fclose(out) != 0;
+
+    if (failed || csfx__build_move(temp, to) != 0)
+    {
+        remove(temp);
+        return -1;
+    }
+    return 0;
+}
+
+static void csfx__build_cachepath(char* path, size_t size, unsigned long long key, const char* ext)
+{
+    snprintf(path, size, "%s/%016llx%s", csfx__build_cachedir, key, ext);
+}
+
+/* Key of unit: command, compiler, source and headers of its make rule.
+ * Without make rule the key differs from any stored one, they are stored with it */
+static unsigned long long csfx__build_unitkey(const csfx__build_t* build, const csfx__unit_t* unit)
+{
+    unsigned long long hash = CSFX__HASH_SEED;
+    hash = csfx__hash(hash, build->compile, strlen(build->compile) + 1);
+    hash = csfx__hash_tool(hash, build->compile);
+    hash = csfx__hash_file(hash, unit->source);
+    csfx__build_deps(unit->object, csfx__hash_file_visit, &hash);
+    return hash;
+}
+
+/* Key of library: command, linker and content of objects */
+static unsigned long long csfx__build_libkey(const csfx__build_t* build)
+{
+    unsigned long long hash = CSFX__HASH_SEED;
+    hash = csfx__hash(hash, build->link, strlen(build->link) + 1);
+    hash = csfx__hash(hash, build->libpath, strlen(build->libpath) + 1);
+    hash = csfx__hash_tool(hash, build->link);
+    for (int i = 0; i < build->unitcount; i++)
+    {
+        hash = csfx__hash_file(hash, build->units[i].object);
+    }
+    return hash;
+}
+
+/* Object and make rule of a unit compiled before with same inputs
+ * @return: 0 when restored from cache */
+static int csfx__build_unit_restore(const csfx__build_t* build, const csfx__unit_t* unit)
+{
+    char cached[CSFX__MAX_PATH * 2];
+    char deppath[CSFX__MAX_PATH];
+    unsigned long long key = csfx__build_unitkey(build, unit);
+
+    csfx__build_cachepath(cached, sizeof(cached), key, ".d");
+    if (csfx__build_deppath(unit->object, deppath, sizeof(deppath)) != 0 || csfx__build_copy(cached, deppath) != 0)
+    {
+        return -1;
+    }
+    csfx__build_cachepath(cached, sizeof(cached), key, ".o");
+    return csfx__build_copy(cached, unit->object);
+}
+
+/* Units without make rule are not stored, changes of their headers are unknown */
+static void csfx__build_unit_store(const csfx__build_t* build, const csfx__unit_t* unit)
+{
+    char cached[CSFX__MAX_PATH * 2];
+    char deppath[CSFX__MAX_PATH];
+    unsigned long long key = csfx__build_unitkey(build, unit);
+
+    FILE* file = csfx__build_deppath(unit->object, deppath, sizeof(deppath)) == 0 ? fopen(deppath, "rb") : NULL;
+    if (file)
+    {
+        fclose(file);
+        csfx__build_cachepath(cached, sizeof(cached), key, ".o");
+        if (csfx__build_copy(unit->object, cached) == 0)
+        {
+            csfx__build_cachepath(cached, sizeof(cached), key, ".d");
+            csfx__build_copy(deppath, cached);
+        }
+    }
+}
+
+/* Parse "file:line[:col]: severity: message" (GCC, Clang, TCC)
+ * and "file(line[,col]): severity code: message" (MSVC) */
+static int csfx__build_parse_line(const char* line, size_t len, csfx_diagnostic_t* diag)
+{
+    static const struct { const char* word; int severity; } severities[] =
+    {
+        { "fatal error", CSFX_DIAG_ERROR   },
+        { "error",       CSFX_DIAG_ERROR   },
+        { "warning",     CSFX_DIAG_WARNING },
+        { "note",        CSFX_DIAG_NOTE    },
+    };
+
+    size_t idx, filelen = 0;
+    const char* ptr = NULL;
+    for (idx = 1; idx < len && !ptr; idx++)
+    {
+        const char* end;
+        if (line[idx] == ':' && line[idx + 1] >= '0' && line[idx + 1] <= '9')
+        {
+            diag->line   = (int)strtol(line + idx + 1, (char**)&end, 10);
+            diag->column = 0;
+            if (*end == ':' && end[1] >= '0' && end[1] <= '9')
+            {
+                diag->column = (int)strtol(end + 1, (char**)&end, 10);
+            }
+            ptr = *end == ':' ? end + 1 : NULL;
+        }
+        else if (line[idx] == '(' && line[idx + 1] >= '0' && line[idx + 1] <= '9')
+        {
+            diag->line   = (int)strtol(line + idx + 1, (char**)&end, 10);
+            diag->column = 0;
+            if (*end == ',')
+            {
+                diag->column = (int)strtol(end + 1, (char**)&end, 10);
+            }
+            ptr = end[0] == ')' && end[1] == ':' ? end + 2 : NULL;
+        }
+        filelen = idx;
+    }
+
+    if (!ptr)
+    {
+        return 0;
+    }
+
+    while (*ptr == ' ')
+    {
+        ptr++;
+    }
+    size_t count = sizeof(severities) / sizeof(severities[0]);
+    for (idx = 0; idx < count; idx++)
+    {
+        size_t wordlen = strlen(severities[idx].word);
+        if (strncmp(ptr, severities[idx].word, wordlen) == 0)
+        {
+            break;
+        }
+    }
+    if (idx == count)
+    {
+        return 0;
+    }
+
+    /* Skip word and MSVC code, up to the message */
+    diag->severity = severities[idx].severity;
+    ptr += strlen(severities[idx].word);
+    while (*ptr && *ptr != ':' && ptr < line + len)
+    {
+        ptr++;
+    }
+    ptr += *ptr == ':';
+    while (*ptr == ' ')
+    {
+        ptr++;
+    }
+
+    snprintf(diag->file, sizeof(diag->file), "%.*s", (int)filelen, line);
+    snprintf(diag->message, sizeof(diag->message), "%.*s", (int)(line + len - ptr), ptr);
+    return 1;
+}
+
+static void csfx__build_parse(csfx__build_t* build)
+{
+    free(build->diags);
+    build->diags     = NULL;
+    build->diagcount = 0;
+
+    const char* line = build->output;
+    while (line && *line)
+    {
+        const char* end = strchr(line, '\n');
+        size_t      len = end ? (size_t)(end - line) : strlen(line);
+        if (len > 0 && line[len - 1] == '\r')
+        {
+            len--;
+        }
+
+        csfx_diagnostic_t diag;
+        if (csfx__build_parse_line(line, len, &diag))
+        {
+            csfx_diagnostic_t* diags = (csfx_diagnostic_t*)realloc(build->diags, sizeof(diag) * (build->diagcount + 1));
+            if (diags)
+            {
+                build->diags = diags;
+                build->diags[build->diagcount++] = diag;
+            }
+        }
+
+        line = end ? end + 1 : NULL;
+    }
+}
+
+static void csfx__log_append(csfx__log_t* log, const char* buffer, size_t size)
+{
+    if (log->len + size + 1 > log->cap)
+    {
+        size_t capacity = log->cap ? log->cap : 4096;
+        while (log->len + size + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+
+        char* text = (char*)realloc(log->text, capacity);
+        if (!text)
+        {
+            return;
+        }
+        log->text = text;
+        log->cap  = capacity;
+    }
+
+    memcpy(log->text + log->len, buffer, size);
+    log->len += size;
+    log->text[log->len] = 0;
+}
+
+#if defined(__linux__)
+/** Build server: resident process spawned once, running commands of builds and pinning the precompiled header **/
+
+/* Program run as build server, it serves from a constructor of the CSFX_IMPL unit before main.
+ * Set it to a helper program built with CSFX_IMPL when the host cannot be started again */
+# ifndef CSFX_BUILD_HELPER
+# define CSFX_BUILD_HELPER "/proc/self/exe"
+# endif
+
+/* Maximum number of commands run at once by the server, more connections wait to be accepted */
+# ifndef CSFX_BUILD_SERVER_JOBS
+# define CSFX_BUILD_SERVER_JOBS 64
+# endif
+
+/* Descriptors of listening socket and of the pipe closed when host exits, named by CSFX_BUILD_SERVER */
+# define CSFX__SERVER_FD     3
+# define CSFX__SERVER_HOSTFD 4
+
+typedef struct
+{
+    pid_t pid;    /* Server started by this process, 0 when served by another one */
+    int   hostfd; /* Server exits when this end is closed */
+    char  path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} csfx__server_t;
+
+static csfx__server_t csfx__server = { 0, -1, { 0 } };
+
+/* Command run by server for one connection, its output is forwarded then '\0' and status in 4 bytes */
+typedef struct
+{
+    int         sock;
+    int         pipe;    /* Output of command, -1 while request is read */
+    pid_t       pid;
+    csfx__log_t request; /* Command then path of header to pin, each ended by '\0' */
+} csfx__serve_t;
+
+/* Precompiled header kept mapped and populated by server, compilers map it without reading disk */
+typedef struct
+{
+    char      path[CSFX__MAX_PATH];
+    long long stamp;
+    void*     map;
+    size_t    size;
+} csfx__pin_t;
+
+static int csfx__write_all(int fd, const void* buffer, size_t size)
+{
+    const char* ptr = (const char*)buffer;
+    while (size > 0)
+    {
+        ssize_t res = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (res <= 0)
+        {
+            return -1;
+        }
+        ptr  += res;
+        size -= (size_t)res;
+    }
+    return 0;
+}
+
+/* Only processes of the same user talk to each other, whatever the mode of socket */
+static int csfx__server_peer(int fd)
+{
+    struct ucred cred;
+    socklen_t    len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid() ? 0 : -1;
+}
+
+static int csfx__server_connect(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, csfx__server.path, sizeof(addr.sun_path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || csfx__server_peer(fd) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void csfx__server_pin(csfx__pin_t* pin, const char* path)
+{
+    long long stamp = path[0] ? csfx__file_stamp(path) : 0;
+    if (stamp == pin->stamp && strcmp(path, pin->path) == 0)
+    {
+        return;
+    }
+
+    if (pin->map)
+    {
+        munmap(pin->map, pin->size);
+    }
+    memset(pin, 0, sizeof(*pin));
+    snprintf(pin->path, sizeof(pin->path), "%s", path);
+    pin->stamp = stamp;
+
+    /* Best effort, locking is bounded by RLIMIT_MEMLOCK */
+    struct stat st;
+    int         fd = stamp ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            mlock(map, (size_t)st.st_size);
+            pin->map  = map;
+            pin->size = (size_t)st.st_size;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+/* Request is complete once command and pin path are read, then command runs with the shell */
+static int csfx__server_start(csfx__serve_t* serve, csfx__pin_t* pin)
+{
+    const char* command = serve->request.text;
+    const char* end     = (const char*)memchr(command, 0, serve->request.len);
+    const char* pinpath = end ? end + 1 : NULL;
+    if (!pinpath || !memchr(pinpath, 0, serve->request.len - (size_t)(pinpath - command)))
+    {
+        return 0;
+    }
+    csfx__server_pin(pin, pinpath);
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+
+    char* argv[] = { (char*)"sh", (char*)"-c", (char*)command, NULL };
+    int   res    = posix_spawn(&serve->pid, "/bin/sh", &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (res != 0)
+    {
+        close(fds[0]);
+        return -1;
+    }
+    serve->pipe = fds[0];
+    return 1;
+}
+
+/* Send status and close connection, a host that went away cancels its command */
+static void csfx__server_finish(csfx__serve_t* serve, int cancel)
+{
+    int wstatus = 0;
+    if (serve->pid > 0 && cancel)
+    {
+        kill(serve->pid, SIGTERM);
+    }
+    int status = serve->pid > 0 && waitpid(serve->pid, &wstatus, 0) == serve->pid && WIFEXITED(wstatus)
+        ? WEXITSTATUS(wstatus) : -1;
+    if (!cancel)
+    {
+        unsigned char trailer[5] = { 0, (unsigned char)(status >> 24), (unsigned char)(status >> 16),
+                                     (unsigned char)(status >> 8), (unsigned char)status };
+        csfx__write_all(serve->sock, trailer, sizeof(trailer));
+    }
+
+    if (serve->pipe >= 0)
+    {
+        close(serve->pipe);
+    }
+    close(serve->sock);
+    free(serve->request.text);
+    memset(serve, 0, sizeof(*serve));
+    serve->sock = -1;
+    serve->pipe = -1;
+}
+
+/* Serve connections of hosts of the same user until the host end is closed.
+ * One process, no fork: commands are spawned and their output multiplexed */
+static void csfx__server_serve(int listenfd, int hostfd)
+{
+    static csfx__serve_t serves[CSFX_BUILD_SERVER_JOBS];
+    struct pollfd        polls[2 + 2 * CSFX_BUILD_SERVER_JOBS];
+    csfx__pin_t          pin;
+    memset(&pin, 0, sizeof(pin));
+
+    int idx;
+    for (idx = 0; idx < CSFX_BUILD_SERVER_JOBS; idx++)
+    {
+        serves[idx].sock = -1;
+        serves[idx].pipe = -1;
+    }
+
+    for (;;)
+    {
+        int free_ = -1;
+        polls[0].fd     = hostfd;
+        polls[0].events = POLLIN;
+        polls[1].fd     = -1;
+        polls[1].events = POLLIN;
+        for (idx = 0; idx < CSFX_BUILD_SERVER_JOBS; idx++)
+        {
+            csfx__serve_t* serve = &serves[idx];
+            polls[2 + 2 * idx].fd     = serve->sock;
+            polls[2 + 2 * idx].events = POLLIN;
+            polls[3 + 2 * idx].fd     = serve->pipe;
+            polls[3 + 2 * idx].events = POLLIN;
+            free_  = free_ < 0 && serve->sock < 0 ? idx : free_;
+        }
+        polls[1].fd = free_ >= 0 ? listenfd : -1;
+
+        if (poll(polls, 2 + 2 * CSFX_BUILD_SERVER_JOBS, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        /* Host closed its end, it exited */
+        if (polls[0].revents)
+        {
+            break;
+        }
+
+        if (polls[1].revents)
+        {
+            int fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0 && csfx__server_peer(fd) != 0)
+            {
+                close(fd);
+            }
+            else if (fd >= 0)
+            {
+                serves[free_].sock = fd;
+            }
+        }
+
+        for (idx = 0; idx < CSFX_BUILD_SERVER_JOBS; idx++)
+        {
+            csfx__serve_t* serve = &serves[idx];
+            char           buffer[4096];
+            ssize_t        size;
+            if (serve->sock < 0 || polls[2 + 2 * idx].fd != serve->sock)
+            {
+                continue;
+            }
+
+            /* Host sends nothing after request, readable means closed */
+            if (polls[2 + 2 * idx].revents && serve->pipe >= 0)
+            {
+                csfx__server_finish(serve, 1);
+                continue;
+            }
+
+            if (polls[2 + 2 * idx].revents)
+            {
+                size = read(serve->sock, buffer, sizeof(buffer));
+                if (size <= 0 && !(size < 0 && errno == EINTR))
+                {
+                    csfx__server_finish(serve, 1);
+                    continue;
+                }
+                csfx__log_append(&serve->request, buffer, size > 0 ? (size_t)size : 0);
+                if (!serve->request.text || csfx__server_start(serve, &pin) < 0)
+                {
+                    csfx__server_finish(serve, 1);
+                }
+                continue;
+            }
+
+            if (serve->pipe >= 0 && polls[3 + 2 * idx].revents)
+            {
+                size = read(serve->pipe, buffer, sizeof(buffer));
+                if (size > 0 && csfx__write_all(serve->sock, buffer, (size_t)size) != 0)
+                {
+                    csfx__server_finish(serve, 1);
+                }
+                else if (size == 0 || (size < 0 && errno != EINTR))
+                {
+                    csfx__server_finish(serve, 0);
+                }
+            }
+        }
+    }
+
+    for (idx = 0; idx < CSFX_BUILD_SERVER_JOBS; idx++)
+    {
+        if (serves[idx].sock >= 0)
+        {
+            csfx__server_finish(&serves[idx], 1);
+        }
+    }
+}
+
+/* Server started by csfx_build_server is this program again, it never returns to main */
+__attribute__((constructor(101))) static void csfx__server_main(void)
+{
+    if (!getenv("CSFX_BUILD_SERVER"))
+    {
+        return;
+    }
+    unsetenv("CSFX_BUILD_SERVER");
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(CSFX__SERVER_FD, F_SETFD, FD_CLOEXEC);
+    fcntl(CSFX__SERVER_HOSTFD, F_SETFD, FD_CLOEXEC);
+    csfx__server_serve(CSFX__SERVER_FD, CSFX__SERVER_HOSTFD);
+
+    /* Socket goes with server, the next host binds a new one */
+    struct sockaddr_un addr;
+    socklen_t          len = sizeof(addr);
+    if (getsockname(CSFX__SERVER_FD, (struct sockaddr*)&addr, &len) == 0 && addr.sun_path[0])
+    {
+        unlink(addr.sun_path);
+    }
+    _exit(0);
+}
+
+static void csfx__server_stop(void)
+{
+    if (csfx__server.pid > 0)
+    {
+        close(csfx__server.hostfd);
+        waitpid(csfx__server.pid, NULL, 0);
+    }
+    csfx__server.pid     = 0;
+    csfx__server.hostfd  = -1;
+    csfx__server.path[0] = 0;
+}
+
+/* Spawn server on a socket bound in a directory only the user can enter.
+ * It is spawned, never forked: the host may run other threads */
+static int csfx__server_spawn(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, csfx__server.path, sizeof(addr.sun_path));
+
+    /* Above the descriptors of server, so no dup2 of spawn overwrites another */
+    int fds[2]   = { -1, -1 };
+    int sock     = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int listenfd = sock >= 0 ? fcntl(sock, F_DUPFD_CLOEXEC, CSFX__SERVER_HOSTFD + 1) : -1;
+    int hostfd   = -1;
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+
+    unlink(csfx__server.path);
+    if (listenfd < 0 || bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenfd, SOMAXCONN) != 0
+        || pipe2(fds, O_CLOEXEC) != 0 || (hostfd = fcntl(fds[0], F_DUPFD_CLOEXEC, CSFX__SERVER_HOSTFD + 1)) < 0)
+    {
+        if (listenfd >= 0) close(listenfd);
+        if (fds[0] >= 0) close(fds[0]);
+        if (fds[1] >= 0) close(fds[1]);
+        return -1;
+    }
+    close(fds[0]);
+
+    /* Environment of host, with the name of the server */
+    int count = 0;
+    while (environ[count])
+    {
+        count++;
+    }
+    char** envp = (char**)malloc((count + 2) * sizeof(char*));
+    int    envc = 0;
+    int    idx;
+    for (idx = 0; envp && idx < count; idx++)
+    {
+        if (strncmp(environ[idx], "CSFX_BUILD_SERVER=", 18) != 0 && strncmp(environ[idx], "CSFX_ISOLATE=", 13) != 0)
+        {
+            envp[envc++] = environ[idx];
+        }
+    }
+
+    pid_t pid = 0;
+    int   res = -1;
+    if (envp)
+    {
+        envp[envc++] = (char*)"CSFX_BUILD_SERVER=1";
+        envp[envc]   = NULL;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, listenfd, CSFX__SERVER_FD);
+        posix_spawn_file_actions_adddup2(&actions, hostfd, CSFX__SERVER_HOSTFD);
+
+        char* argv[] = { (char*)"csfx-build", NULL };
+        res = posix_spawn(&pid, CSFX_BUILD_HELPER, &actions, NULL, argv, envp);
+        posix_spawn_file_actions_destroy(&actions);
+        free(envp);
+    }
+    close(listenfd);
+    close(hostfd);
+    if (res != 0)
+    {
+        close(fds[1]);
+        unlink(csfx__server.path);
+        return -1;
+    }
+
+    csfx__server.pid    = pid;
+    csfx__server.hostfd = fds[1];
+    return 0;
+}
+
+/* Send command to server, its output and status come on the returned socket.
+ * The precompiled header of builds is pinned by server before command runs
+ * @return: socket, -1 when there is no server */
+static int csfx__server_request(const char* command)
+{
+    char pinpath[CSFX__MAX_PATH + 8];
+    snprintf(pinpath, sizeof(pinpath), "%s%s", csfx__build_pchheader, csfx__build_pchheader[0] ? ".gch" : "");
+
+    int fd = csfx__server.path[0] ? csfx__server_connect() : -1;
+    if (fd >= 0 && (csfx__write_all(fd, command, strlen(command) + 1) != 0
+                    || csfx__write_all(fd, pinpath, strlen(pinpath) + 1) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return fd;
+}
+#endif
+
+/* Launch command with the shell, its stdout and stderr go to one pipe */
+static int csfx__job_spawn(csfx__job_t* job, const char* command)
+{
+    job->log.len = 0;
+    csfx__log_append(&job->log, "", 0);
+
+#if defined(_WIN32)
+    SECURITY_ATTRIBUTES sa;
+    sa.nLength              = sizeof(sa);
+    sa.lpSecurityDescriptor = NULL;
+    sa.bInheritHandle       = TRUE;
+
+    HANDLE readpipe, writepipe;
+    if (!CreatePipe(&readpipe, &writepipe, &sa, 0))
+    {
+        return -1;
+    }
+    SetHandleInformation(readpipe, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOA        si;
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si));
+    si.cb         = sizeof(si);
+    si.dwFlags    = STARTF_USESTDHANDLES;
+    si.hStdInput  = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = writepipe;
+    si.hStdError  = writepipe;
+
+    size_t len     = strlen(command) + 16;
+    char*  cmdline = (char*)malloc(len);
+    if (!cmdline)
+    {
+        CloseHandle(readpipe);
+        CloseHandle(writepipe);
+        return -1;
+    }
+    snprintf(cmdline, len, "cmd.exe /c %s", command);
+
+    BOOL created = CreateProcessA(NULL, cmdline, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+    free(cmdline);
+    CloseHandle(writepipe);
+    if (!created)
+    {
+        CloseHandle(readpipe);
+        return -1;
+    }
+
+    CloseHandle(pi.hThread);
+    job->process = pi.hProcess;
+    job->pipe    = readpipe;
+#else
+# if defined(__linux__)
+    /* Run by build server when there is one, pid 0 marks its socket in place of pipe */
+    int sock = csfx__server_request(command);
+    if (sock >= 0)
+    {
+        job->pid  = 0;
+        job->pipe = sock;
+        return 0;
+    }
+# endif
+
+    /* Both ends close-on-exec at creation, so no process spawned meanwhile inherits them,
+     * dup2 onto stdout and stderr of the compiler clears the flag on its copies */
+    int fds[2];
+# if defined(__APPLE__)
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+# else
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        return -1;
+    }
+# endif
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    char* argv[] = { (char*)"sh", (char*)"-c", (char*)command, NULL };
+    int   res    = posix_spawn(&job->pid, "/bin/sh", &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (res != 0)
+    {
+        close(fds[0]);
+        return -1;
+    }
+
+    job->pipe = fds[0];
+#endif
+
+    return 0;
+}
+
+/* Drain output, never block
+ * @return: 1 when command exited, its status in status */
+static int csfx__job_drain(csfx__job_t* job, int* status)
+{
+    char buffer[4096];
+
+#if defined(_WIN32)
+    DWORD avail, size;
+    while (PeekNamedPipe(job->pipe, NULL, 0, NULL, &avail, NULL) && avail > 0
+           && ReadFile(job->pipe, buffer, sizeof(buffer), &size, NULL) && size > 0)
+    {
+        csfx__log_append(&job->log, buffer, size);
+    }
+
+    DWORD code;
+    if (WaitForSingleObject(job->process, 0) != WAIT_OBJECT_0 || !GetExitCodeProcess(job->process, &code))
+    {
+        return 0;
+    }
+    while (ReadFile(job->pipe, buffer, sizeof(buffer), &size, NULL) && size > 0)
+    {
+        csfx__log_append(&job->log, buffer, size);
+    }
+
+    CloseHandle(job->process);
+    CloseHandle(job->pipe);
+    *status = (int)code;
+#else
+    ssize_t size;
+    while ((size = read(job->pipe, buffer, sizeof(buffer))) > 0)
+    {
+        csfx__log_append(&job->log, buffer, (size_t)size);
+    }
+
+    /* Server ends output with '\0' and status in 4 bytes, none when it went away */
+    if (job->pid == 0)
+    {
+        if (size < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return 0;
+        }
+
+        const unsigned char* trailer = (const unsigned char*)job->log.text + job->log.len - 5;
+        if (job->log.len >= 5 && trailer[0] == 0)
+        {
+            *status = (int)(((unsigned)trailer[1] << 24) | ((unsigned)trailer[2] << 16) | ((unsigned)trailer[3] << 8) | trailer[4]);
+            job->log.len -= 5;
+            job->log.text[job->log.len] = 0;
+        }
+        else
+        {
+            *status = -1;
+        }
+        close(job->pipe);
+        return 1;
+    }
+
+    int   wstatus;
+    pid_t res = waitpid(job->pid, &wstatus, WNOHANG);
+    if (res == 0 || (res < 0 && errno == EINTR))
+    {
+        return 0;
+    }
+
+    /* Children of compiler may still hold the pipe, take what is written and go on */
+    while ((size = read(job->pipe, buffer, sizeof(buffer))) > 0)
+    {
+        csfx__log_append(&job->log, buffer, (size_t)size);
+    }
+
+    close(job->pipe);
+    *status = res > 0 && WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+#endif
+
+    return 1;
+}
+
+static void csfx__job_kill(csfx__job_t* job)
+{
+#if defined(_WIN32)
+    TerminateProcess(job->process, 1);
+    WaitForSingleObject(job->process, INFINITE);
+    CloseHandle(job->process);
+    CloseHandle(job->pipe);
+#else
+    /* Server kills the command of a closed socket */
+    if (job->pid > 0)
+    {
+        kill(job->pid, SIGTERM);
+        waitpid(job->pid, NULL, 0);
+    }
+    close(job->pipe);
+#endif
+    free(job->log.text);
+}
+
+/* Start job with a token, nothing is started when all tokens are taken
+ * @return: 1 when started, 0 when no token, -1 on failure */
+static int csfx__build_job(csfx__build_t* build, int unit, const char* command)
+{
+    if (!command || !csfx__build_token_take())
+    {
+        return command ? 0 : -1;
+    }
+
+    csfx__job_t* job = &build->jobs[build->jobcount];
+    memset(job, 0, sizeof(*job));
+    job->unit = unit;
+    if (csfx__job_spawn(job, command) != 0)
+    {
+        free(job->log.text);
+        csfx__build_token_give();
+        return -1;
+    }
+
+    build->jobcount++;
+    return 1;
+}
+
+#define CSFX__BUILD_PCH -2 /* Unit of job running the command of precompiled header */
+
+/* Run command of precompiled header when it is older than header or its make rule.
+ * Another build running it is waited for, so no unit reads the header while it is written
+ * @return: 1 when header is fresh or has no command, 0 while it is rebuilt */
+static int csfx__build_pch_start(csfx__build_t* build)
+{
+    if (build->precompiled < 0)
+    {
+        return 0;
+    }
+
+    char gchpath[CSFX__MAX_PATH + 8];
+    snprintf(gchpath, sizeof(gchpath), "%s.gch", csfx__build_pchheader);
+
+    long long stamp = csfx__file_stamp(gchpath);
+    if (!csfx__build_pchcommand
+        || (stamp > 0 && stamp >= csfx__build_depstamp(gchpath, csfx__file_stamp(csfx__build_pchheader))))
+    {
+        build->precompiled = 1;
+        return 1;
+    }
+
+#if defined(_MSC_VER)
+    if (InterlockedCompareExchangePointer((void* volatile*)&csfx__build_pchowner, build, NULL) != NULL)
+#else
+    if (!__sync_bool_compare_and_swap(&csfx__build_pchowner, NULL, build))
+#endif
+    {
+        return 0;
+    }
+
+    const char* keys[]   = { "src", "obj" };
+    const char* values[] = { csfx__build_pchheader, gchpath };
+    char*       command  = csfx__build_format(csfx__build_pchcommand, keys, values, 2);
+    int         started  = csfx__build_job(build, CSFX__BUILD_PCH, command);
+    free(command);
+    if (started <= 0)
+    {
+        csfx__build_pchowner = NULL;
+    }
+    if (started < 0)
+    {
+        const char* message = "csfx: cannot precompile header\n";
+        csfx__log_append(&build->log, message, strlen(message));
+        build->precompiled = 1;
+        return 1;
+    }
+
+    build->precompiled = -started;
+    return 0;
+}
+
+/* Command of precompiled header exited or was killed, a header it failed on is removed */
+static void csfx__build_pch_done(csfx__build_t* build, int status)
+{
+    if (status != 0)
+    {
+        char gchpath[CSFX__MAX_PATH + 8];
+        snprintf(gchpath, sizeof(gchpath), "%s.gch", csfx__build_pchheader);
+        csfx__remove_file(gchpath);
+        build->failed += status > 0;
+    }
+    build->precompiled   = 1;
+    csfx__build_pchowner = NULL;
+}
+
+/* Command of library, optimized tier or patch. Patch has changed objects only, linked against base */
+static char* csfx__build_link_command(csfx__build_t* build, const char* base)
+{
+    size_t size = 1;
+    for (int i = 0; i < build->unitcount; i++)
+    {
+        size += strlen(build->units[i].object) + 1;
+    }
+
+    char* objects = (char*)malloc(size);
+    if (!objects)
+    {
+        return NULL;
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < build->unitcount; i++)
+    {
+        if (!build->patching || build->units[i].changed)
+        {
+            len += (size_t)sprintf(objects + len, len > 0 ? " %s" : "%s", build->units[i].object);
+        }
+    }
+    objects[len] = 0;
+
+    const char* keys[]   = { "objs", "out", "base" };
+    const char* values[] = {
+        objects,
+        build->tiering ? build->tierpath : build->patching || build->patched > 0 ? build->patchpath : build->libpath,
+        base ? base : ""
+    };
+    const char* format   = build->tiering ? build->tier : build->patching ? build->patch : build->link;
+    char*       command  = csfx__build_format(format, keys, values, 3);
+    free(objects);
+    return command;
+}
+
+/* Compile outdated units as tokens allow, link when all of them are done
+ * @return: 1 when build completed, result in status */
+static int csfx__build_step(csfx__build_t* build, int* status)
+{
+    char message[CSFX__MAX_PATH * 2];
+
+    for (int i = 0; i < build->jobcount; i++)
+    {
+        csfx__job_t* job = &build->jobs[i];
+
+        int res;
+        if (!csfx__job_drain(job, &res))
+        {
+            continue;
+        }
+
+        int unit = job->unit;
+        csfx__build_token_give();
+        csfx__log_append(&build->log, job->log.text, job->log.len);
+        free(job->log.text);
+        build->jobs[i--] = build->jobs[--build->jobcount];
+
+        if (unit == CSFX__BUILD_PCH)
+        {
+            csfx__build_pch_done(build, res);
+        }
+        else if (unit < 0)
+        {
+            /* Library relinked after its patch is swapped in at once, its time is taken by poll */
+            if (build->patched > 0 && !build->patching && !build->tiering)
+            {
+                if (res == 0 && csfx__build_move(build->patchpath, build->libpath) != 0)
+                {
+                    snprintf(message, sizeof(message), "csfx: cannot replace %s\n", build->libpath);
+                    csfx__log_append(&build->log, message, strlen(message));
+                    res = 1;
+                }
+                if (res != 0)
+                {
+                    csfx__remove_file(build->patchpath);
+                }
+            }
+
+            if (res == 0 && build->cached && csfx__build_cachedir[0])
+            {
+                csfx__build_cachepath(message, sizeof(message), build->libkey, strrchr(build->libpath, '.'));
+                csfx__build_copy(build->libpath, message);
+            }
+            *status = res;
+            return 1;
+        }
+        else if (res != 0)
+        {
+            build->failed++;
+        }
+        else if (csfx__build_cachedir[0])
+        {
+            csfx__build_unit_store(build, &build->units[unit]);
+        }
+    }
+
+    if (build->precompiled <= 0 && !build->tiering)
+    {
+        int started = csfx__build_pch_start(build);
+        if (started <= 0)
+        {
+            return 0;
+        }
+    }
+
+    while (build->next < build->unitcount)
+    {
+        csfx__unit_t* unit  = &build->units[build->next];
+        long long     stamp = csfx__file_stamp(unit->object);
+        if (stamp > 0 && stamp >= csfx__build_depstamp(unit->object, csfx__file_stamp(unit->source)))
+        {
+            build->next++;
+            continue;
+        }
+        else if (csfx__build_cachedir[0] && csfx__build_unit_restore(build, unit) == 0)
+        {
+            unit->changed = 1;
+            build->next++;
+            continue;
+        }
+
+        const char* keys[]   = { "src", "obj" };
+        const char* values[] = { unit->source, unit->object };
+        char*       command  = csfx__build_format(build->compile, keys, values, 2);
+        int         started  = csfx__build_job(build, build->next, command);
+        free(command);
+        if (started == 0)
+        {
+            return 0;
+        }
+        else if (started < 0)
+        {
+            snprintf(message, sizeof(message), "csfx: cannot compile %s\n", unit->source);
+            csfx__log_append(&build->log, message, strlen(message));
+            build->failed++;
+        }
+
+        unit->changed    = started > 0;
+        build->compiled += started > 0;
+        build->next++;
+    }
+
+    if (build->jobcount > 0 || build->linking)
+    {
+        return 0;
+    }
+    else if (build->failed > 0)
+    {
+        *status = 1;
+        return 1;
+    }
+
+    /* Relink only when an object is newer than library, optimized build always runs */
+    int relink = build->tiering || build->unitcount == 0 || build->compiled > 0;
+    if (!relink)
+    {
+        long long libstamp = csfx__file_stamp(build->libpath);
+        for (int i = 0; i < build->unitcount && !relink; i++)
+        {
+            relink = csfx__file_stamp(build->units[i].object) > libstamp;
+        }
+    }
+    if (!relink)
+    {
+        *status = 0;
+        return 1;
+    }
+
+    /* Changed units of loaded library are linked into a patch first, see csfx__library_patch */
+    char base[CSFX__MAX_PATH];
+    if (build->patch && !build->tiering && !build->patched && build->library
+        && csfx__library_shadow(build->library, base, sizeof(base)) == 0)
+    {
+        for (int i = 0; i < build->unitcount && !build->patching; i++)
+        {
+            build->patching = build->units[i].changed;
+        }
+    }
+
+    if (build->patching)
+    {
+        snprintf(build->patchpath, sizeof(build->patchpath), "%s.patch%d", build->libpath, ++csfx__build_patches);
+        char* command = csfx__build_link_command(build, base);
+        int   started = csfx__build_job(build, -1, command);
+        free(command);
+        build->cached   = 0;
+        build->linking  = started > 0;
+        build->patching = started > 0;
+        if (started >= 0)
+        {
+            return 0;
+        }
+        build->patched = -1;
+    }
+
+    /* Library linked before from same objects */
+    build->cached = !build->tiering && build->unitcount > 0 && strrchr(build->libpath, '.');
+    if (build->cached && csfx__build_cachedir[0])
+    {
+        build->libkey = csfx__build_libkey(build);
+        csfx__build_cachepath(message, sizeof(message), build->libkey, strrchr(build->libpath, '.'));
+        if (csfx__build_copy(message, build->libpath) == 0)
+        {
+            *status = 0;
+            return 1;
+        }
+    }
+
+    char* command = csfx__build_link_command(build, NULL);
+    int   started = csfx__build_job(build, -1, command);
+    free(command);
+    if (started < 0)
+    {
+        snprintf(message, sizeof(message), "csfx: cannot link %s\n", build->libpath);
+        csfx__log_append(&build->log, message, strlen(message));
+        *status = 1;
+        return 1;
+    }
+
+    build->linking = started;
+    return 0;
+}
+
+/* Start build, its jobs are spawned by polls. The optimized tier links its command only */
+static void csfx__build_start(csfx__build_t* build, int tiering)
+{
+    build->log.len  = 0;
+    csfx__log_append(&build->log, "", 0);
+    build->running  = 1;
+    build->again    = 0;
+    build->tiering  = tiering;
+    build->next     = tiering ? build->unitcount : 0;
+    build->compiled = 0;
+    build->failed   = 0;
+    build->linking  = 0;
+    build->patching = 0;
+    build->patched  = 0;
+    build->precompiled = 0;
+    for (int i = 0; i < build->unitcount; i++)
+    {
+        build->units[i].changed = 0;
+    }
+}
+
+/* Kill jobs of running build, output of an unfinished optimized build is removed */
+static void csfx__build_cancel(csfx__build_t* build)
+{
+    for (int i = 0; i < build->jobcount; i++)
+    {
+        csfx__job_kill(&build->jobs[i]);
+        csfx__build_token_give();
+        if (build->jobs[i].unit == CSFX__BUILD_PCH)
+        {
+            csfx__build_pch_done(build, -1);
+        }
+    }
+
+    if (build->running && build->tiering)
+    {
+        csfx__remove_file(build->tierpath);
+    }
+    if (build->running && (build->patching || build->patched > 0))
+    {
+        csfx__remove_file(build->patchpath);
+    }
+    build->jobcount = 0;
+    build->running  = 0;
+    build->tiering  = 0;
+    build->patching = 0;
+}
+
+/* libtime is set to the relinked library when library was patched, that one is not reloaded.
+ * An optimized library swapped in, or a library relinked after a patch that cannot apply,
+ * is newer than libtime and reloaded
+ * @return: CSFX_BUILT or CSFX_BUILD_FAILED when a build completed, CSFX_NONE otherwise */
+static int csfx__build_poll(csfx__build_t* build, void* library, long long* libtime)
+{
+    int status;
+    if (build)
+    {
+        /* A patch that cannot be written anymore leaves the relinked library to reload */
+        int waiting    = build->waiting && library ? csfx__library_patch_retry(library) : 0;
+        build->library = library;
+        build->waiting = waiting > 0;
+        *libtime       = waiting < 0 ? 0 : *libtime;
+    }
+    if (!build || !build->running || !csfx__build_step(build, &status))
+    {
+        return CSFX_NONE;
+    }
+
+    /* Library is relinked after its patch in any case, reloaded only when the patch cannot apply */
+    if (build->patching)
+    {
+        build->patching = 0;
+        build->linking  = 0;
+        int patched     = status == 0 ? csfx__library_patch(library, build->patchpath) : -1;
+        build->patched  = patched >= 0 ? 1 : -1;
+        build->waiting  = patched > 0;
+        csfx__remove_file(build->patchpath);
+        if (build->patched < 0)
+        {
+            const char* message = "csfx: cannot patch library, reloading it\n";
+            csfx__log_append(&build->log, message, strlen(message));
+        }
+        return CSFX_NONE;
+    }
+
+    if (build->patched > 0 && status == 0)
+    {
+        *libtime = csfx__file_stamp(build->libpath);
+    }
+
+    int tiering = build->tiering;
+    if (tiering && status == 0)
+    {
+        if (csfx__build_move(build->tierpath, build->libpath) != 0)
+        {
+            const char* message = "csfx: cannot replace library with optimized build\n";
+            csfx__log_append(&build->log, message, strlen(message));
+            status = 1;
+        }
+    }
+
+    free(build->output);
+    build->output   = build->log.text;
+    build->log.text = NULL;
+    build->log.len  = 0;
+    build->log.cap  = 0;
+    build->running  = 0;
+    build->tiering  = 0;
+    csfx__build_parse(build);
+
+    if (build->again)
+    {
+        csfx__build_start(build, 0);
+    }
+    else if (!tiering && status == 0 && build->tier)
+    {
+        csfx__build_start(build, 1);
+    }
+    return status == 0 ? CSFX_BUILT : CSFX_BUILD_FAILED;
+}
+
+static void csfx__build_free(csfx__build_t* build)
+{
+    if (!build)
+    {
+        return;
+    }
+
+    csfx__build_cancel(build);
+    for (int i = 0; i < build->unitcount; i++)
+    {
+        free(build->units[i].source);
+        free(build->units[i].object);
+    }
+
+    free(build->compile);
+    free(build->link);
+    free(build->libpath);
+    free(build->units);
+    free(build->tier);
+    free(build->tierpath);
+    free(build->patch);
+    free(build->jobs);
+    free(build->log.text);
+    free(build->output);
+    free(build->diags);
+    free(build);
+}
+
+/* @impl: csfx_script_init */
+void csfx_script_init(csfx_script_t* script, const char* libpath)
+{
+    typedef csfx__script_data_t data_t;
+    
+    script->state    = CSFX_NONE;
+    script->errcode  = CSFX_ERROR_NONE;
+    script->userdata = NULL;
+
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = (data_t*)(malloc(sizeof(data_t)));
+
+    if (data)
+    {
+        *dptr = data;
+
+        data->libtime = 0;
+        data->library = NULL;
+        memset(&data->fault, 0, sizeof(data->fault));
+        data->faultmsg[0] = 0;
+        data->faultlock   = 0;
+        data->isolate     = NULL;
+        data->layout      = NULL;
+        data->stale       = NULL;
+        data->stalemsg[0] = 0;
+        data->regions     = NULL;
+        data->regioncount = 0;
+        data->regioncapacity = 0;
+        data->build       = NULL;
+        csfx__arena_init(&data->arena);
+        csfx__get_temp_path(libpath, data->libtpath, CSFX__MAX_PATH);
+    
+    #if defined(_MSC_VER) && _MSC_VER >= 1200
+        strncpy_s(data->librpath, libpath, CSFX__MAX_PATH);
+    #else
+        strncpy(data->librpath, libpath, CSFX__MAX_PATH);
+    #endif
+    
+    #if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
+        data->delpdb  = FALSE;
+        data->pdbtime = 0;
+        csfx__get_pdb_path(libpath, data->pdbrpath, CSFX__MAX_PATH);
+        csfx__get_temp_path(data->pdbrpath, data->pdbtpath, CSFX__MAX_PATH);
+    #endif
+    }
+}
+
+int csfx_script_init_isolated(csfx_script_t* script, const char* libpath)
+{
+    typedef csfx__script_data_t data_t;
+
+    csfx_script_init(script, libpath);
+
+    data_t* data = *(data_t**)(&script->internal);
+    return data ? csfx__isolate_create(data) : -1;
+}
+
+void csfx_script_free(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    if (!script) return;
+
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    if (data->isolate)
+    {
+        csfx__isolate_free(script);
+    }
+
+    /* Raise quit event */
+    if (data->library)
+    {
+        script->state = CSFX_QUIT;
+        csfx__call_main(script, data->library, script->state);
+        csfx__library_leave(data->library, 0);
+        csfx__library_release(data->library); /* Temp library is removed with last script */
+        
+#if defined(_MSC_VER) && defined(CSFX_PDB_DELETE)
+        csfx__copy_file(data->pdbtpath, data->pdbrpath);
+        csfx__remove_file(data->pdbtpath);
+#endif
+    }
+
+    /* Clean up */
+    free(data->layout);
+    csfx__stale_apply(data->stale, NULL, NULL, 0);
+    free(data->regions);
+    csfx__build_free((csfx__build_t*)data->build);
+    csfx__arena_release(&data->arena);
+    free(data);
+    *dptr = NULL;
+}
+
+/* Raise unload event and keep what the next version need, library is still mapped.
+ * A version that failed is not told to unload, and it already left the library */
+static int csfx__script_detach(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr    = (data_t**)(&script->internal);
+    data_t*  data    = *dptr;
+    void*    library = data->library;
+
+    /* Raise unload event */
+    int failed = script->state == CSFX_FAILED;
+    if (!failed)
+    {
+        script->state = CSFX_UNLOAD;
+        csfx__call_main(script, library, script->state);
+    }
+
+    /* Keep layout of state for the next version, globals are kept by the last script leaving */
+    if (!failed)
+    {
+        csfx__library_leave(library, 1);
+    }
+    free(data->layout);
+    data->layout  = csfx__layout_clone(library);
+    data->stale   = csfx__stale_unload(data, &data->arena, library);
+    data->library = NULL;
+
+    if (failed || script->errcode != CSFX_ERROR_NONE)
+    {
+        script->state = CSFX_FAILED;
+        return script->state;
+    }
+    else
+    {
+        return script->state;
+    }
+}
+
+/* Raise unload event and free library, keep what the next version need */
+static int csfx__script_unload(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr    = (data_t**)(&script->internal);
+    data_t*  data    = *dptr;
+    void*    library = data->library;
+
+    int state = csfx__script_detach(script);
+
+    /* Collect garbage */
+    csfx__library_release(library);
+    return state;
+}
+
+/* Copy library to temp path and load it, or share it with other scripts of the same library.
+ * No event is raised, safe on any thread */
+static void* csfx__script_prepare(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    return csfx__library_acquire(data->librpath, &data->arena);
+}
+
+/* Raise init or reload event on prepared library, it stays loaded when the event failed */
+static int csfx__script_enter(csfx_script_t* script, void* library)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    if (library)
+    {
+        int state = script->state; /* new state */
+        state = state == CSFX_NONE ? CSFX_INIT : CSFX_RELOAD;
+
+        /* Carry state of old version, or of restored snapshot on init */
+        csfx__globals_load(csfx__library_enter(library), state == CSFX_RELOAD ? library : NULL);
+        csfx__stale_apply(data->stale, library, data->stalemsg, CSFX__MAX_FAULTMSG);
+        script->userdata = csfx__layout_reload(&data->arena, data->layout, library, script->userdata);
+        data->stale   = NULL;
+        free(data->layout);
+        data->layout = NULL;
+        csfx__call_main(script, library, state);
+
+        data->library = library;
+        data->libtime = csfx__file_stamp(data->librpath);
+
+        if (script->errcode != CSFX_ERROR_NONE)
+        {
+            csfx__library_leave(library, 0);
+            script->state = CSFX_FAILED;
+        }
+        else
+        {
+            script->state = state;
+
+        #if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
+        # if defined(CSFX_PDB_DELETE)
+            csfx__remove_file(data->pdbtpath);
+            csfx__copy_file(data->pdbrpath, data->pdbtpath);
+        # endif
+            csfx__unlock_pdb_file(data, data->pdbrpath);
+            data->pdbtime = csfx__last_modify_time(data->pdbrpath);
+        #endif
+        }
+    }
+
+    return script->state;
+}
+
+/* Raise init or reload event on prepared library */
+static int csfx__script_commit(csfx_script_t* script, void* library)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    if (csfx__script_enter(script, library) == CSFX_FAILED && data->library)
+    {
+        csfx__library_release(data->library);
+        data->library = NULL;
+    }
+    return script->state;
+}
+
+static int csfx__script_load(csfx_script_t* script)
+{
+    return csfx__script_commit(script, csfx__script_prepare(script));
+}
+
+int csfx_script_update(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    /* Report completed build first, its library is reloaded by next updates */
+    int built = csfx__build_poll((csfx__build_t*)data->build, data->library, &data->libtime);
+    if (built != CSFX_NONE)
+    {
+        return built;
+    }
+
+    if (data->isolate)
+    {
+        return csfx__isolate_update(script);
+    }
+
+#if 0
+    if (data->delpdb)
+    {
+        HANDLE fileHandle = CreateFileA(
+            data->pdbrpath,
+            GENERIC_READ,
+            0,
+            NULL,
+            OPEN_EXISTING,
+            FILE_DELETE_ON_CLOSE,
+            NULL);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(fileHandle);
+        }
+
+        if (csfx__remove_file(data->pdbrpath))
+        {
+            int a = 0;
+            int b = 1;
+
+            a = a + b;
+        }
+        else
+        {
+            int a = 0;
+            int b = 1;
+
+            a = a + b;
+        }
+    }
+#endif
+    
+    if (csfx__script_changed(script))
+    {
+        /* Unload old version first, load new version on next update */
+        if (data->library)
+        {
+            return csfx__script_unload(script);
+        }
+        else
+        {
+            return csfx__script_load(script);
+        }
+    }
+    else
+    {
+        if (script->state != CSFX_FAILED)
+        {
+            script->state = CSFX_NONE;
+        }
+
+        return CSFX_NONE;
+    }
+}
+
+/* @impl: csfx_script_call_timeout */
+int csfx_script_call_timeout(csfx_script_t* script, void (*func)(void*), long budget_us)
+{
+#if defined(__unix__)
+    /* Concurrent calls on one script must not write to script, only the fault is stored */
+    csfx__script_data_t* data    = *(csfx__script_data_t**)(&script->internal);
+    volatile int         errcode = CSFX_ERROR_NONE;
+    csfx_try ((csfx_script_t*)NULL)
+    {
+        /* Counted as a call of script all the same, patches wait for it */
+        csfx__frame.calls = csfx__calls_enter(data->library);
+        if (budget_us > 0 && csfx__timeout_arm(budget_us) != 0)
+        {
+            errcode = -1;
+        }
+        else
+        {
+            func(script->userdata);
+        }
+    }
+    csfx_except ((csfx_script_t*)NULL)
+    {
+        errcode = csfx__frame.errcode;
+        csfx__fault_store(script);
+    }
+    csfx__timeout_disarm();
+
+    return errcode;
+#else
+    volatile int armed = 1;
+    csfx_try (script)
+    {
+        armed = budget_us <= 0 || csfx__timeout_arm(budget_us) == 0;
+        if (armed)
+        {
+            func(script->userdata);
+        }
+    }
+    csfx_except (script)
+    {
+        /* Error code is set by the guard */
+    }
+    csfx__timeout_disarm();
+
+    return armed ? script->errcode : -1;
+#endif
+}
+
+void* csfx_script_symbol(csfx_script_t* script, const char* name)
+{
+    typedef csfx__script_data_t data_t;
+
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+    return data->library ? csfx__library_symbol(data->library, name) : NULL;
+}
+
+/* @impl: csfx_script_invoke */
+int csfx_script_invoke(csfx_script_t* script, const char* name,
+                       const void* input, int inlen, void* output, int outcap)
+{
+    typedef csfx__script_data_t data_t;
+
+    data_t* data = *(data_t**)(&script->internal);
+    if (data->isolate)
+    {
+        return csfx__isolate_invoke(script, name, input, inlen, output, outcap);
+    }
+
+    csfx_invoke_f func = (csfx_invoke_f)csfx_script_symbol(script, name);
+    if (!func)
+    {
+        return -1;
+    }
+
+    volatile int result = -1;
+    csfx_try (script)
+    {
+        result = func(script->userdata, input, inlen, output, outcap);
+    }
+    csfx_except (script)
+    {
+        result = -1;
+    }
+    return result;
+}
+
+csfx_arena_t* csfx_script_arena(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+    csfx__isolate_arena(data);
+    return &data->arena;
+}
+
+const char* csfx_script_errmsg(const csfx_script_t* script)
+{
+#if defined(CSFX_LIBTCC)
+    typedef csfx__script_data_t data_t;
+    
+    data_t* const* dptr = (data_t* const*)(&script->internal);
+    if (csfx__tcc_source((*dptr)->librpath))
+    {
+        return csfx__tcc_errors;
+    }
+#else
+    (void)script;
+#endif
+    return csfx__dlib_errmsg();
+}
+
+const csfx_fault_t* csfx_script_fault(const csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t* const* dptr = (data_t* const*)(&script->internal);
+    data_t*        data = *dptr;
+    return &data->fault;
+}
+
+const char* csfx_script_faultmsg(const csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t* const* dptr = (data_t* const*)(&script->internal);
+    data_t*        data = *dptr;
+    return data->faultmsg;
+}
+
+/* @impl: csfx_script_region */
+int csfx_script_region(csfx_script_t* script, void* ptr, size_t size)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    int idx;
+    for (idx = 0; idx < data->regioncount; idx++)
+    {
+        if (data->regions[idx].ptr == (char*)ptr)
+        {
+            break;
+        }
+    }
+
+    if (size == 0)
+    {
+        if (idx < data->regioncount)
+        {
+            data->regions[idx] = data->regions[--data->regioncount];
+        }
+        return 0;
+    }
+
+    if (idx == data->regioncapacity)
+    {
+        int             capacity = data->regioncapacity ? data->regioncapacity * 2 : 8;
+        csfx__region_t* regions  = (csfx__region_t*)realloc(data->regions, sizeof(csfx__region_t) * capacity);
+        if (!regions)
+        {
+            return -1;
+        }
+        data->regions        = regions;
+        data->regioncapacity = capacity;
+    }
+
+    data->regions[idx].ptr  = (char*)ptr;
+    data->regions[idx].size = size;
+    if (idx == data->regioncount)
+    {
+        data->regioncount++;
+    }
+    return 0;
+}
+
+/* @impl: csfx_script_snapshot */
+int csfx_script_snapshot(csfx_script_t* script, const char* path)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+    return csfx__snapshot_save(data, script->userdata, path);
+}
+
+/* @impl: csfx_script_restore */
+int csfx_script_restore(csfx_script_t* script, const char* path)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+    if (data->library || script->userdata)
+    {
+        return -1;
+    }
+    return csfx__snapshot_load(data, &script->userdata, path);
+}
+
+const char* csfx_script_stalemsg(const csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t* const* dptr = (data_t* const*)(&script->internal);
+    data_t*        data = *dptr;
+    return data->stalemsg;
+}
+
+/* @impl: csfx_script_build */
+int csfx_script_build(csfx_script_t* script, const char* command)
+{
+    return csfx_script_build_units(script, NULL, command, NULL, 0);
+}
+
+/* @impl: csfx_script_build_units */
+int csfx_script_build_units(csfx_script_t* script, const char* compile, const char* link, const char* const* sources, int count)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    csfx__build_free((csfx__build_t*)data->build);
+    data->build = NULL;
+    if (!link)
+    {
+        return 0;
+    }
+    if (count > 0 && (!compile || !sources))
+    {
+        return -1;
+    }
+
+    csfx__build_t* build = (csfx__build_t*)calloc(1, sizeof(csfx__build_t));
+    if (!build)
+    {
+        return -1;
+    }
+
+    build->link    = csfx__strdup(link);
+    build->libpath = csfx__strdup(data->librpath);
+    build->compile = compile ? csfx__strdup(compile) : NULL;
+    build->units   = (csfx__unit_t*)calloc(count > 0 ? count : 1, sizeof(csfx__unit_t));
+    build->jobs    = (csfx__job_t*)calloc(count > 0 ? count : 1, sizeof(csfx__job_t));
+    int failed = !build->link || !build->libpath || (compile && !build->compile) || !build->units || !build->jobs;
+
+    for (int i = 0; i < count && !failed; i++, build->unitcount++)
+    {
+        csfx__unit_t* unit = &build->units[i];
+        const char*   ext  = strrchr(sources[i], '.');
+        size_t        len  = ext && !strpbrk(ext, "/\\") ? (size_t)(ext - sources[i]) : strlen(sources[i]);
+
+        unit->source = csfx__strdup(sources[i]);
+        unit->object = (char*)malloc(len + 3);
+        if (!unit->source || !unit->object)
+        {
+            build->unitcount++;
+            failed = 1;
+            break;
+        }
+        memcpy(unit->object, sources[i], len);
+        memcpy(unit->object + len, ".o", 3);
+    }
+
+    if (failed)
+    {
+        csfx__build_free(build);
+        return -1;
+    }
+
+    data->build = build;
+    return 0;
+}
+
+/* @impl: csfx_script_compile */
+int csfx_script_compile(csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    csfx__build_t* build = (csfx__build_t*)data->build;
+    if (!build)
+    {
+        return -1;
+    }
+    if (build->running && !build->tiering)
+    {
+        build->again = 1;
+        return 0;
+    }
+
+    /* Fast build of a change goes first, optimized build of old sources is useless */
+    csfx__build_cancel(build);
+    csfx__build_start(build, 0);
+    return 0;
+}
+
+/* @impl: csfx_script_build_tier */
+int csfx_script_build_tier(csfx_script_t* script, const char* command)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    csfx__build_t* build = (csfx__build_t*)data->build;
+    if (!build)
+    {
+        return -1;
+    }
+    if (build->tiering)
+    {
+        csfx__build_cancel(build);
+    }
+
+    free(build->tier);
+    free(build->tierpath);
+    build->tier     = NULL;
+    build->tierpath = NULL;
+    if (!command)
+    {
+        return 0;
+    }
+
+    size_t len      = strlen(build->libpath) + 6;
+    build->tier     = csfx__strdup(command);
+    build->tierpath = (char*)malloc(len);
+    if (!build->tier || !build->tierpath)
+    {
+        free(build->tier);
+        free(build->tierpath);
+        build->tier     = NULL;
+        build->tierpath = NULL;
+        return -1;
+    }
+    snprintf(build->tierpath, len, "%s.tier", build->libpath);
+    return 0;
+}
+
+/* @impl: csfx_script_build_patch */
+int csfx_script_build_patch(csfx_script_t* script, const char* command)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t** dptr = (data_t**)(&script->internal);
+    data_t*  data = *dptr;
+
+    csfx__build_t* build = (csfx__build_t*)data->build;
+    if (!build || build->unitcount == 0)
+    {
+        return -1;
+    }
+
+    free(build->patch);
+    build->patch = NULL;
+    if (!command)
+    {
+        return 0;
+    }
+
+    build->patch = csfx__strdup(command);
+    return build->patch ? 0 : -1;
+}
+
+/* @impl: csfx_build_cache */
+int csfx_build_cache(const char* directory)
+{
+    csfx__build_cachedir[0] = 0;
+    if (!directory)
+    {
+        return 0;
+    }
+    if (strlen(directory) >= sizeof(csfx__build_cachedir))
+    {
+        return -1;
+    }
+
+#if defined(_WIN32)
+    DWORD attributes = GetFileAttributesA(directory);
+    if (attributes == INVALID_FILE_ATTRIBUTES ? !CreateDirectoryA(directory, NULL) : !(attributes & FILE_ATTRIBUTE_DIRECTORY))
+#else
+    struct stat st;
+    if (stat(directory, &st) == 0 ? !S_ISDIR(st.st_mode) : mkdir(directory, 0755) != 0)
+#endif
+    {
+        return -1;
+    }
+
+    memcpy(csfx__build_cachedir, directory, strlen(directory) + 1);
+    return 0;
+}
+
+/* @impl: csfx_build_pch */
+int csfx_build_pch(const char* header, const char* command)
+{
+    free(csfx__build_pchcommand);
+    csfx__build_pchcommand   = NULL;
+    csfx__build_pchheader[0] = 0;
+#if defined(CSFX_LIBTCC)
+    csfx__tcc_set_header("");
+#endif
+    if (!header)
+    {
+        return 0;
+    }
+    if (!command || strlen(header) >= sizeof(csfx__build_pchheader))
+    {
+        return -1;
+    }
+
+    memcpy(csfx__build_pchheader, header, strlen(header) + 1);
+    csfx__build_pchcommand = csfx__strdup(command);
+#if defined(CSFX_LIBTCC)
+    csfx__tcc_set_header(csfx__build_pchcommand ? header : "");
+#endif
+    return csfx__build_pchcommand ? 0 : -1;
+}
+
+/* @impl: csfx_build_server */
+int csfx_build_server(const char* directory)
+{
+#if defined(__linux__)
+    csfx__server_stop();
+    if (!directory)
+    {
+        return 0;
+    }
+
+    /* Only the user can reach the socket, a directory others may enter is refused */
+    struct stat st;
+    if ((size_t)snprintf(csfx__server.path, sizeof(csfx__server.path), "%s/build.sock", directory) >= sizeof(csfx__server.path)
+        || (mkdir(directory, 0700) != 0 && errno != EEXIST) || lstat(directory, &st) != 0 || !S_ISDIR(st.st_mode)
+        || st.st_uid != getuid() || (st.st_mode & 077) != 0)
+    {
+        csfx__server.path[0] = 0;
+        return -1;
+    }
+
+    /* Server of another host of the user serves this one too, until it exits */
+    int fd = csfx__server_connect();
+    if (fd >= 0)
+    {
+        close(fd);
+        return 0;
+    }
+    if (csfx__server_spawn() != 0)
+    {
+        csfx__server.path[0] = 0;
+        return -1;
+    }
+    return 0;
+#else
+    (void)directory;
+    return -1;
+#endif
+}
+
+/* @impl: csfx_script_diagnostics */
+int csfx_script_diagnostics(const csfx_script_t* script, const csfx_diagnostic_t** diagnostics)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t* const* dptr  = (data_t* const*)(&script->internal);
+    csfx__build_t* build = (csfx__build_t*)(*dptr)->build;
+    if (diagnostics)
+    {
+        *diagnostics = build ? build->diags : NULL;
+    }
+    return build ? build->diagcount : 0;
+}
+
+/* @impl: csfx_script_buildlog */
+const char* csfx_script_buildlog(const csfx_script_t* script)
+{
+    typedef csfx__script_data_t data_t;
+    
+    data_t* const* dptr  = (data_t* const*)(&script->internal);
+    csfx__build_t* build = (csfx__build_t*)(*dptr)->build;
+    return build ? build->output : NULL;
+}
+
+/* @impl: csfx_watch_files */
+int csfx_watch_files(csfx_filetime_t* files, int count)
 {
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags     = SA_SIGINFO | SA_RESTART | SA_NODEFER;
-    sa.sa_handler   = NULL;
-    sa.sa_sigaction = csfx__sighandler;
+    int changed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (csfx__file_changed(&files[i]))
+        {
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/** Scripts manager: one watcher, only changed scripts and their dependents are updated **/
+#if defined(__linux__)
+# include <sys/inotify.h>
+
+/* Compilers often replace the library by rename, plugins come and go */
+# define CSFX__WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM)
+#endif
+
+#if !defined(_WIN32)
+# include <dirent.h>
+# include <fnmatch.h>
+#endif
+
+typedef struct csfx__managed csfx__managed_t;
+struct csfx__managed
+{
+    csfx_script_t     script;   /* First, so script is also the item */
+    int               watch;    /* Watch descriptor of directory of library */
+    int               dir;      /* Plugin directory it was discovered in, -1 when added by host */
+    int               pending;  /* Check on next csfx_manager_update */
+    int               mark;     /* Visited by graph walks */
+    int               retry;    /* Rolled back, update again with the next change */
+    long long         libtime;  /* Stamp of current version, restored on rollback */
+    int               depcount;
+    int               dependentcount;
+    csfx__managed_t** deps;     /* Scripts this one resolve symbols from */
+    csfx__managed_t** dependents;
+    char              name[CSFX__MAX_PATH]; /* File name of library */
+};
+
+typedef struct
+{
+    int  watch;     /* Watch descriptor, -1 when scanned every update */
+    int  dirty;     /* A matching file was added or removed */
+    char path[CSFX__MAX_PATH];
+    char pattern[CSFX__MAX_PATH];
+} csfx__plugindir_t;
+
+typedef struct
+{
+    int                fd;  /* Watcher, -1 when polling all scripts */
+    int                capacity;
+    csfx__managed_t**  items;
+    csfx__managed_t**  pending;
+    int                pendingcount;
+    csfx__managed_t**  order;       /* Scratch of graph walks */
+    void**             libraries;   /* Loaded libraries of a batch, not committed yet */
+    void**             olds;        /* Detached libraries of a transaction, until it is committed */
+    csfx_transition_t* transitions; /* A quit or a build, an unload and a load per script at most, twice on rollback */
+    int                transaction; /* Between csfx_reload_begin and csfx_reload_commit */
+    int                dircount;
+    csfx__plugindir_t* dirs;
+    int                deadcount;
+    csfx__managed_t**  dead;        /* Quitted plugins, freed on next update as transitions refer them */
+} csfx__manager_t;
+
+/* Maximum number of threads copying and loading libraries of a batch */
+#ifndef CSFX_LOAD_THREADS
+#define CSFX_LOAD_THREADS 8
+#endif
+
+typedef struct
+{
+    csfx__managed_t** items;
+    void**            libraries;
+    int               count;
+    volatile int      next;
+} csfx__batch_t;
+
+#if !defined(_WIN32)
+static void* csfx__batch_worker(void* userdata)
+{
+    csfx__batch_t* batch = (csfx__batch_t*)userdata;
 
     int idx;
-    for (idx = 0; idx < csfx__countof(csfx__signals); idx++)
+    while ((idx = __sync_fetch_and_add(&batch->next, 1)) < batch->count)
     {
-	if (sigaction(csfx__signals[idx], &sa, NULL) != 0)
-	{
-	    return -1;
-	}
+        batch->libraries[idx] = csfx__script_prepare(&batch->items[idx]->script);
+    }
+    return NULL;
+}
+#endif
+
+/* Copy and load libraries on worker threads, events are raised later on caller thread */
+static void csfx__batch_prepare(csfx__batch_t* batch, int threads)
+{
+#if !defined(_WIN32)
+    pthread_t workers[CSFX_LOAD_THREADS];
+    int       spawned = 0;
+
+    threads = threads > 0 && threads < CSFX_LOAD_THREADS ? threads : CSFX_LOAD_THREADS;
+    threads = threads < batch->count ? threads : batch->count;
+    for (; spawned < threads - 1; spawned++)
+    {
+        if (pthread_create(&workers[spawned], NULL, csfx__batch_worker, batch) != 0)
+        {
+            break;
+        }
+    }
+
+    /* Caller is a worker too, and the only one when threads cannot be created */
+    csfx__batch_worker(batch);
+
+    int idx;
+    for (idx = 0; idx < spawned; idx++)
+    {
+        pthread_join(workers[idx], NULL);
+    }
+#else
+    (void)threads;
+    
+    int idx;
+    for (idx = 0; idx < batch->count; idx++)
+    {
+        batch->libraries[idx] = csfx__script_prepare(&batch->items[idx]->script);
+    }
+#endif
+}
+
+static void csfx__manager_mark(csfx__manager_t* mgr, csfx__managed_t* item)
+{
+    if (!item->pending)
+    {
+        item->pending = 1;
+        mgr->pending[mgr->pendingcount++] = item;
+    }
+}
+
+/* Drain events of watcher, mark scripts whose library was written or replaced */
+static void csfx__manager_poll(csfx__manager_t* mgr, int count)
+{
+    int idx;
+    if (mgr->fd < 0)
+    {
+        for (idx = 0; idx < count; idx++)
+        {
+            csfx__manager_mark(mgr, mgr->items[idx]);
+        }
+        return;
+    }
+
+#if defined(__linux__)
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
+    {
+        ssize_t len = read(mgr->fd, buffer, sizeof(buffer));
+        if (len <= 0)
+        {
+            break;
+        }
+
+        char* ptr;
+        for (ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len)
+        {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            for (idx = 0; idx < mgr->dircount; idx++)
+            {
+                csfx__plugindir_t* dir = &mgr->dirs[idx];
+                if ((event->mask & IN_Q_OVERFLOW)
+                    || (dir->watch == event->wd && event->len && fnmatch(dir->pattern, event->name, 0) == 0))
+                {
+                    dir->dirty = 1;
+                }
+            }
+            for (idx = 0; idx < count; idx++)
+            {
+                csfx__managed_t* item = mgr->items[idx];
+                if ((event->mask & IN_Q_OVERFLOW)
+                    || (item->watch == event->wd && event->len && strcmp(item->name, event->name) == 0))
+                {
+                    csfx__manager_mark(mgr, item);
+                }
+            }
+        }
+    }
+#endif
+}
+
+static int csfx__manager_link(csfx__managed_t*** list, int* count, csfx__managed_t* item)
+{
+    csfx__managed_t** items = (csfx__managed_t**)realloc(*list, sizeof(csfx__managed_t*) * (*count + 1));
+    if (!items)
+    {
+        return -1;
     }
 
+    items[(*count)++] = item;
+    *list = items;
     return 0;
 }
 
-void csfx_quit(void)
+static void csfx__manager_unlink(csfx__managed_t** list, int* count, csfx__managed_t* item)
 {
     int idx;
-    for (idx = 0; idx < csfx__countof(csfx__signals); idx++)
+    for (idx = 0; idx < *count; idx++)
     {
-	if (signal(csfx__signals[idx], SIG_DFL) != 0)
-	{
-	    break;
-	}
+        if (list[idx] == item)
+        {
+            list[idx] = list[--(*count)];
+            break;
+        }
+    }
+}
+
+/* Depth first from item through dependencies, may it reach target */
+static int csfx__manager_reaches(csfx__manager_t* mgr, csfx__managed_t* item, csfx__managed_t* target)
+{
+    int top = 0, found = 0, visited = 0;
+
+    item->mark = 1;
+    mgr->order[top++] = item;
+    while (top > 0 && !found)
+    {
+        csfx__managed_t* node = mgr->order[--top];
+        mgr->pending[mgr->pendingcount + visited++] = node; /* Unmarked after walk */
+        
+        int idx;
+        for (idx = 0; idx < node->depcount && !found; idx++)
+        {
+            csfx__managed_t* dep = node->deps[idx];
+            found = dep == target;
+            if (!dep->mark)
+            {
+                dep->mark = 1;
+                mgr->order[top++] = dep;
+            }
+        }
+    }
+
+    int idx;
+    for (idx = 0; idx < top; idx++)
+    {
+        mgr->order[idx]->mark = 0;
+    }
+    for (idx = 0; idx < visited; idx++)
+    {
+        mgr->pending[mgr->pendingcount + idx]->mark = 0;
+    }
+    return found || item == target;
+}
+
+/* Dependencies first, only through marked items */
+static void csfx__manager_sort(csfx__managed_t* item, csfx__managed_t** order, int* count)
+{
+    item->mark = 2;
+
+    int idx;
+    for (idx = 0; idx < item->depcount; idx++)
+    {
+        if (item->deps[idx]->mark == 1)
+        {
+            csfx__manager_sort(item->deps[idx], order, count);
+        }
+    }
+    order[(*count)++] = item;
+}
+
+/* Free plugins quitted by previous update */
+static void csfx__manager_bury(csfx__manager_t* mgr)
+{
+    int idx;
+    for (idx = 0; idx < mgr->deadcount; idx++)
+    {
+        free(mgr->dead[idx]->deps);
+        free(mgr->dead[idx]->dependents);
+        free(mgr->dead[idx]);
     }
+    free(mgr->dead);
+    mgr->dead      = NULL;
+    mgr->deadcount = 0;
 }
+
+/* @impl: csfx_manager_init */
+int csfx_manager_init(csfx_manager_t* manager)
+{
+    csfx__manager_t* mgr = (csfx__manager_t*)calloc(1, sizeof(csfx__manager_t));
+    if (!mgr)
+    {
+        return -1;
+    }
+
+#if defined(__linux__)
+    mgr->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 #else
-#error "Unsupported platform"
+    mgr->fd = -1;
 #endif
 
-static int csfx__remove_file(const char* path)
+    manager->count    = 0;
+    manager->threads  = 0;
+    manager->internal = mgr;
+    return 0;
+}
+
+/* @impl: csfx_manager_free */
+void csfx_manager_free(csfx_manager_t* manager)
 {
-    return remove(path) == 0;
+    csfx__manager_t* mgr = (csfx__manager_t*)manager->internal;
+    if (!mgr)
+    {
+        return;
+    }
+
+    /* Dependents quit before their dependencies */
+    int idx, count = 0;
+    for (idx = 0; idx < manager->count; idx++)
+    {
+        mgr->items[idx]->mark = 1;
+    }
+    for (idx = 0; idx < manager->count; idx++)
+    {
+        if (mgr->items[idx]->mark == 1)
+        {
+            csfx__manager_sort(mgr->items[idx], mgr->order, &count);
+        }
+    }
+    for (idx = count - 1; idx >= 0; idx--)
+    {
+        csfx__managed_t* item = mgr->order[idx];
+        csfx_script_free(&item->script);
+        free(item->deps);
+        free(item->dependents);
+        free(item);
+    }
+
+#if defined(__linux__)
+    if (mgr->fd >= 0)
+    {
+        close(mgr->fd);
+    }
+#endif
+
+    free(mgr->items);
+    free(mgr->pending);
+    free(mgr->order);
+    free(mgr->libraries);
+    free(mgr->olds);
+    free(mgr->transitions);
+    free(mgr->dirs);
+    csfx__manager_bury(mgr);
+    free(mgr);
+
+    manager->count    = 0;
+    manager->internal = NULL;
 }
 
-static int csfx__get_temp_path(const char* path, char* buffer, int length)
+/* @impl: csfx_manager_add */
+csfx_script_t* csfx_manager_add(csfx_manager_t* manager, const char* libpath)
 {
-    int res;
-    
-    if (buffer)
-    { 
-        int version = 0;
-        while (1)
+    csfx__manager_t* mgr = (csfx__manager_t*)manager->internal;
+    if (manager->count == mgr->capacity)
+    {
+        int capacity = mgr->capacity ? mgr->capacity * 2 : 16;
+
+        /* Reachability walks use the tail of pending, it needs room for all items twice */
+        csfx__managed_t**  items       = (csfx__managed_t**)realloc(mgr->items, sizeof(csfx__managed_t*) * capacity);
+        if (items) mgr->items = items;
+        csfx__managed_t**  pending     = (csfx__managed_t**)realloc(mgr->pending, sizeof(csfx__managed_t*) * capacity * 2);
+        if (pending) mgr->pending = pending;
+        csfx__managed_t**  order       = (csfx__managed_t**)realloc(mgr->order, sizeof(csfx__managed_t*) * capacity);
+        if (order) mgr->order = order;
+        void**             libraries   = (void**)realloc(mgr->libraries, sizeof(void*) * capacity);
+        if (libraries) mgr->libraries = libraries;
+        void**             olds        = (void**)realloc(mgr->olds, sizeof(void*) * capacity);
+        if (olds) mgr->olds = olds;
+        csfx_transition_t* transitions = (csfx_transition_t*)realloc(mgr->transitions, sizeof(csfx_transition_t) * capacity * 6);
+        if (transitions) mgr->transitions = transitions;
+        
+        if (!items || !pending || !order || !libraries || !olds || !transitions)
         {
-            res = snprintf(buffer, length, "%s.%d", path, version++);
+            return NULL;
+        }
+        mgr->capacity = capacity;
+    }
+
+    csfx__managed_t* item = (csfx__managed_t*)calloc(1, sizeof(csfx__managed_t));
+    if (!item)
+    {
+        return NULL;
+    }
+
+    csfx_script_init(&item->script, libpath);
+    item->watch = -1;
+    item->dir   = -1;
+
+    /* Watch directory, compilers often replace the library by rename */
+    const char* slash = strrchr(libpath, '/');
+#if defined(_WIN32)
+    const char* bslash = strrchr(libpath, '\\');
+    slash = bslash > slash ? bslash : slash;
+#endif
+    snprintf(item->name, sizeof(item->name), "%s", slash ? slash + 1 : libpath);
+
+#if defined(__linux__)
+    if (mgr->fd >= 0)
+    {
+        char dirpath[CSFX__MAX_PATH];
+        snprintf(dirpath, sizeof(dirpath), "%.*s", slash ? (int)(slash - libpath) + 1 : 1, slash ? libpath : ".");
+        item->watch = inotify_add_watch(mgr->fd, dirpath, CSFX__WATCH_MASK);
+    }
+#endif
+
+    /* Cannot be watched, poll it every update */
+    if (item->watch < 0 && mgr->fd >= 0)
+    {
+        item->watch = -2;
+    }
+
+    mgr->items[manager->count++] = item;
+    csfx__manager_mark(mgr, item);
+    return &item->script;
+}
+
+/* @impl: csfx_manager_depend */
+int csfx_manager_depend(csfx_manager_t* manager, csfx_script_t* script, csfx_script_t* dependency)
+{
+    csfx__manager_t* mgr  = (csfx__manager_t*)manager->internal;
+    csfx__managed_t* item = (csfx__managed_t*)script;
+    csfx__managed_t* dep  = (csfx__managed_t*)dependency;
+
+    int idx;
+    for (idx = 0; idx < item->depcount; idx++)
+    {
+        if (item->deps[idx] == dep)
+        {
+            return 0;
+        }
+    }
+
+    /* Keep the graph acyclic */
+    if (csfx__manager_reaches(mgr, dep, item))
+    {
+        return -1;
+    }
+
+    if (csfx__manager_link(&item->deps, &item->depcount, dep) != 0)
+    {
+        return -1;
+    }
+    if (csfx__manager_link(&dep->dependents, &dep->dependentcount, item) != 0)
+    {
+        item->depcount--;
+        return -1;
+    }
+    return 0;
+}
+
+/* Take script out of manager and its graph, the script itself is untouched */
+static void csfx__manager_detach(csfx_manager_t* manager, csfx__managed_t* item)
+{
+    csfx__manager_t* mgr  = (csfx__manager_t*)manager->internal;
+
+    int idx, shared = 0;
+    for (idx = 0; idx < manager->count; idx++)
+    {
+        if (mgr->items[idx] == item)
+        {
+            mgr->items[idx] = mgr->items[--manager->count];
+            idx--;
+        }
+        else if (item->watch >= 0 && mgr->items[idx]->watch == item->watch)
+        {
+            shared = 1;
+        }
+    }
+    for (idx = 0; idx < mgr->dircount; idx++)
+    {
+        if (item->watch >= 0 && mgr->dirs[idx].watch == item->watch)
+        {
+            shared = 1;
+        }
+    }
+
+    csfx__manager_unlink(mgr->pending, &mgr->pendingcount, item);
+    for (idx = 0; idx < item->depcount; idx++)
+    {
+        csfx__manager_unlink(item->deps[idx]->dependents, &item->deps[idx]->dependentcount, item);
+    }
+    for (idx = 0; idx < item->dependentcount; idx++)
+    {
+        csfx__manager_unlink(item->dependents[idx]->deps, &item->dependents[idx]->depcount, item);
+    }
+
+#if defined(__linux__)
+    if (item->watch >= 0 && !shared)
+    {
+        inotify_rm_watch(mgr->fd, item->watch);
+    }
+#else
+    (void)shared;
+#endif
+}
+
+/* @impl: csfx_manager_remove */
+void csfx_manager_remove(csfx_manager_t* manager, csfx_script_t* script)
+{
+    csfx__managed_t* item = (csfx__managed_t*)script;
+
+    csfx__manager_detach(manager, item);
+    csfx_script_free(&item->script);
+    free(item->deps);
+    free(item->dependents);
+    free(item);
+}
+
+/* Add new plugins of directory, quit ones which disappeared
+ * @return: number of quit transitions, written after first ones */
+static int csfx__manager_scan(csfx_manager_t* manager, int dir, int first)
+{
+    csfx__manager_t*   mgr     = (csfx__manager_t*)manager->internal;
+    csfx__plugindir_t* plugins = &mgr->dirs[dir];
+
+    int idx, count = 0;
+    for (idx = 0; idx < manager->count; idx++)
+    {
+        mgr->items[idx]->mark = mgr->items[idx]->dir == dir; /* Not seen yet */
+    }
+
+    char libpath[CSFX__MAX_PATH * 2]; /* Directory and name */
+#if defined(_WIN32)
+    WIN32_FIND_DATAA find;
+    snprintf(libpath, sizeof(libpath), "%s\\%s", plugins->path, plugins->pattern);
+    HANDLE handle = FindFirstFileA(libpath, &find);
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            const char* name = find.cFileName;
+            if (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                continue;
+            }
+#else
+    DIR* handle = opendir(plugins->path);
+    if (handle)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(handle)) != NULL)
+        {
+            const char* name = entry->d_name;
+            if (name[0] == '.' || fnmatch(plugins->pattern, name, 0) != 0)
+            {
+                continue;
+            }
+#endif
 
-        #if defined(_MSC_VER) && _MSC_VER >= 1200
-            FILE* file;
-            if (fopen_s(&file, buffer, "r") != 0)
+            int found = 0;
+            for (idx = 0; idx < manager->count && !found; idx++)
             {
-                file = NULL;
+                csfx__managed_t* item = mgr->items[idx];
+                if (item->dir == dir && strcmp(item->name, name) == 0)
+                {
+                    item->mark = 0;
+                    found      = 1;
+                }
             }
-        #else
-            FILE* file = fopen(buffer, "r");
-        #endif
 
-            if (file)
+            if (!found)
             {
-                fclose(file);
+                snprintf(libpath, sizeof(libpath), "%s/%s", plugins->path, name);
+                csfx__managed_t* item = (csfx__managed_t*)csfx_manager_add(manager, libpath);
+                if (item)
+                {
+                    item->dir = dir;
+                }
+            }
+#if defined(_WIN32)
+        } while (FindNextFileA(handle, &find));
+        FindClose(handle);
+    }
+#else
+        }
+        closedir(handle);
+    }
+#endif
+
+    /* Disappeared plugins quit now, they are freed on next update */
+    for (idx = 0; idx < manager->count; idx++)
+    {
+        csfx__managed_t* item = mgr->items[idx];
+        if (item->mark)
+        {
+            item->mark = 0;
+            csfx__manager_detach(manager, item);
+            csfx_script_free(&item->script);
+            idx--;
+
+            if (csfx__manager_link(&mgr->dead, &mgr->deadcount, item) == 0)
+            {
+                mgr->transitions[first + count].script = &item->script;
+                mgr->transitions[first + count].state  = CSFX_QUIT;
+                count++;
             }
             else
             {
-                break;
+                free(item->deps);
+                free(item->dependents);
+                free(item);
             }
         }
     }
 
-    return res;
+    plugins->dirty = 0;
+    return count;
 }
 
-static int csfx__script_changed(csfx_script_t* script)
+/* @impl: csfx_plugin_dir */
+int csfx_plugin_dir(csfx_manager_t* manager, const char* path, const char* pattern)
 {
-    typedef csfx__script_data_t data_t;
+    csfx__manager_t* mgr = (csfx__manager_t*)manager->internal;
 
-    data_t** dptr = (data_t**)(&script->internal);
-    data_t*  data = *dptr;
-    
-    long src = data->libtime;
-    long cur = csfx__last_modify_time(data->librpath);
-    int  res = cur > src;
-#if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
-    if (res)
-    {  
-        src = data->pdbtime;
-        cur = csfx__last_modify_time(data->pdbrpath);
-        res = (cur == src && cur == 0) || cur > src;
+    csfx__plugindir_t* dirs = (csfx__plugindir_t*)realloc(mgr->dirs, sizeof(csfx__plugindir_t) * (mgr->dircount + 1));
+    if (!dirs)
+    {
+        return -1;
     }
+    mgr->dirs = dirs;
+
+    csfx__plugindir_t* dir = &mgr->dirs[mgr->dircount];
+    dir->watch = -1;
+    dir->dirty = 1;
+    snprintf(dir->path, sizeof(dir->path), "%s", path);
+#if defined(_WIN32)
+    snprintf(dir->pattern, sizeof(dir->pattern), "%s", pattern ? pattern : "*.dll");
+#else
+    snprintf(dir->pattern, sizeof(dir->pattern), "%s", pattern ? pattern : "*.so");
 #endif
-    return res;
+
+#if defined(__linux__)
+    if (mgr->fd >= 0)
+    {
+        dir->watch = inotify_add_watch(mgr->fd, path, CSFX__WATCH_MASK);
+    }
+#endif
+
+    mgr->dircount++;
+    return 0;
 }
 
-static int csfx__file_changed(csfx_filetime_t* ft)
+/* Discover plugins, then move changed scripts and all of their dependents to pending,
+ * dependencies first. Quits of disappeared plugins and completed builds are written to transitions
+ * @return: number of scripts to update */
+static int csfx__manager_collect(csfx_manager_t* manager, int* reports)
 {
-    long src = ft->time;
-    long cur = csfx__last_modify_time(ft->path);
-    
-    if (cur > src)
+    csfx__manager_t* mgr = (csfx__manager_t*)manager->internal;
+
+    csfx__manager_poll(mgr, manager->count);
+
+    int idx;
+    for (idx = 0, *reports = 0; idx < mgr->dircount; idx++)
     {
-        ft->time = cur;
-        return 1;
+        if (mgr->dirs[idx].dirty || mgr->dirs[idx].watch < 0)
+        {
+            *reports += csfx__manager_scan(manager, idx, *reports);
+        }
     }
-    else
+
+    /* Libraries of completed builds are reloaded when the watcher notices them */
+    for (idx = 0; idx < manager->count; idx++)
     {
-        return 0;
+        csfx__script_data_t* data  = *(csfx__script_data_t**)(&mgr->items[idx]->script.internal);
+        int                  built = csfx__build_poll((csfx__build_t*)data->build, data->library, &data->libtime);
+        if (built != CSFX_NONE)
+        {
+            mgr->transitions[*reports].script = &mgr->items[idx]->script;
+            mgr->transitions[*reports].state  = built;
+            (*reports)++;
+        }
     }
-}
 
-static int csfx__call_main(csfx_script_t* script, void* library, int state)
-{
-    typedef void* (*csfx_main_f)(void*, int, int);
+    int count = manager->count;
+    for (idx = 0; idx < count; idx++)
+    {
+        if (mgr->items[idx]->watch == -2)
+        {
+            csfx__manager_mark(mgr, mgr->items[idx]);
+        }
+    }
 
-    const char* name = "csfx_main";
-    csfx_main_f func = (csfx_main_f)csfx__dlib_symbol(library, name);
+    /* Changed scripts and all of their dependents */
+    int affected = 0;
+    for (idx = 0; idx < mgr->pendingcount; idx++)
+    {
+        csfx__managed_t* item = mgr->pending[idx];
+        item->pending = 0;
+        if (!item->mark && csfx__script_changed(&item->script))
+        {
+            item->mark = 1;
+            mgr->order[affected++] = item;
+        }
+    }
+    mgr->pendingcount = 0;
 
-    if (func)
+    /* Scripts of a rolled back transaction go together with the next change */
+    if (affected > 0)
     {
-        csfx_try (script)
+        for (idx = 0; idx < count; idx++)
         {
-            script->userdata = func(script->userdata, script->state, state);
+            csfx__managed_t* item = mgr->items[idx];
+            if (item->retry && !item->mark)
+            {
+                item->mark = 1;
+                mgr->order[affected++] = item;
+            }
+            item->retry = 0;
         }
-        csfx_except (script)
+    }
+
+    for (idx = 0; idx < affected; idx++)
+    {
+        csfx__managed_t* item = mgr->order[idx];
+
+        int dep;
+        for (dep = 0; dep < item->dependentcount; dep++)
         {
-            return -1;
+            if (!item->dependents[dep]->mark)
+            {
+                item->dependents[dep]->mark = 1;
+                mgr->order[affected++] = item->dependents[dep];
+            }
         }
     }
 
-    return 0;
+    /* Sort them, dependencies first */
+    int sorted = 0;
+    for (idx = 0; idx < affected; idx++)
+    {
+        if (mgr->order[idx]->mark == 1)
+        {
+            csfx__manager_sort(mgr->order[idx], mgr->pending, &sorted);
+        }
+    }
+    for (idx = 0; idx < sorted; idx++)
+    {
+        mgr->pending[idx]->mark = 0;
+    }
+    return sorted;
 }
 
-/* @impl: csfx_script_init */
-void csfx_script_init(csfx_script_t* script, const char* libpath)
+/* @impl: csfx_manager_update */
+int csfx_manager_update(csfx_manager_t* manager, const csfx_transition_t** transitions)
 {
-    typedef csfx__script_data_t data_t;
-    
-    script->state    = CSFX_NONE;
-    script->errcode  = CSFX_ERROR_NONE;
-    script->userdata = NULL;
+    csfx__manager_t* mgr   = (csfx__manager_t*)manager->internal;
+    int              count = 0;
 
-    data_t** dptr = (data_t**)(&script->internal);
-    data_t*  data = (data_t*)(malloc(sizeof(data_t)));
+    csfx__manager_bury(mgr);
 
-    if (data)
+    /* Changes are kept for csfx_reload_commit */
+    if (mgr->transaction)
     {
-        *dptr = data;
+        csfx__manager_poll(mgr, manager->count);
+        if (transitions)
+        {
+            *transitions = mgr->transitions;
+        }
+        return 0;
+    }
 
-        data->libtime = 0;
-        data->library = NULL;
-        csfx__get_temp_path(libpath, data->libtpath, CSFX__MAX_PATH);
-    
-    #if defined(_MSC_VER) && _MSC_VER >= 1200
-        strncpy_s(data->librpath, libpath, CSFX__MAX_PATH);
-    #else
-        strncpy(data->librpath, libpath, CSFX__MAX_PATH);
-    #endif
-    
-    #if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
-        data->delpdb  = FALSE;
-        data->pdbtime = 0;
-        csfx__get_pdb_path(libpath, data->pdbrpath, CSFX__MAX_PATH);
-        csfx__get_temp_path(data->pdbrpath, data->pdbtpath, CSFX__MAX_PATH);
-    #endif
+    /* Discovered plugins may grow transitions */
+    int idx, sorted = csfx__manager_collect(manager, &count);
+    if (transitions)
+    {
+        *transitions = mgr->transitions;
     }
-}
 
-void csfx_script_free(csfx_script_t* script)
-{
-    typedef csfx__script_data_t data_t;
-    
-    if (!script) return;
+    /* Unload dependents first, then load dependencies first, all in this update.
+     * Copy and dlopen run on worker threads, events in order on this thread */
+    for (idx = sorted - 1; idx >= 0; idx--)
+    {
+        csfx__managed_t* item = mgr->pending[idx];
+        csfx__script_data_t* data = *(csfx__script_data_t**)(&item->script.internal);
+        if (data->library)
+        {
+            mgr->transitions[count].script = &item->script;
+            mgr->transitions[count].state  = csfx__script_unload(&item->script);
+            count++;
+        }
+    }
 
-    data_t** dptr = (data_t**)(&script->internal);
-    data_t*  data = *dptr;
+    csfx__batch_t batch;
+    batch.items     = mgr->pending;
+    batch.libraries = mgr->libraries;
+    batch.count     = sorted;
+    batch.next      = 0;
+    csfx__batch_prepare(&batch, manager->threads);
 
-    /* Raise quit event */
-    if (data->library)
+    for (idx = 0; idx < sorted; idx++)
     {
-        script->state = CSFX_QUIT;
-        csfx__call_main(script, data->library, script->state);
-        csfx__dlib_free(data->library);
+        csfx__managed_t* item = mgr->pending[idx];
 
-        /* Remove temp library */
-        csfx__remove_file(data->libtpath); /* Ignore error code */
-	
-#if defined(_MSC_VER) && defined(CSFX_PDB_DELETE)
-        csfx__copy_file(data->pdbtpath, data->pdbrpath);
-        csfx__remove_file(data->pdbtpath);
-#endif
+        mgr->transitions[count].script = &item->script;
+        mgr->transitions[count].state  = csfx__script_commit(&item->script, mgr->libraries[idx]);
+        count++;
     }
 
-    /* Clean up */
-    free(data);
-    *dptr = NULL;
+    return count;
 }
 
-int csfx_script_update(csfx_script_t* script)
+/* @impl: csfx_reload_begin */
+void csfx_reload_begin(csfx_manager_t* manager)
+{
+    csfx__manager_t* mgr = (csfx__manager_t*)manager->internal;
+    mgr->transaction = 1;
+}
+
+/* @impl: csfx_reload_commit */
+int csfx_reload_commit(csfx_manager_t* manager, const csfx_transition_t** transitions, int* count)
 {
     typedef csfx__script_data_t data_t;
-    
-    data_t** dptr = (data_t**)(&script->internal);
-    data_t*  data = *dptr;
 
-#if 0
-    if (data->delpdb)
+    csfx__manager_t* mgr = (csfx__manager_t*)manager->internal;
+    int              num = 0;
+
+    mgr->transaction = 0;
+    csfx__manager_bury(mgr);
+
+    /* Discovered plugins may grow transitions */
+    int idx, sorted = csfx__manager_collect(manager, &num);
+    if (transitions)
     {
-        HANDLE fileHandle = CreateFileA(
-            data->pdbrpath,
-            GENERIC_READ,
-            0,
-            NULL,
-            OPEN_EXISTING,
-            FILE_DELETE_ON_CLOSE,
-            NULL);
-        if (fileHandle != INVALID_HANDLE_VALUE)
+        *transitions = mgr->transitions;
+    }
+
+    /* Stage all new versions beside the current ones, nothing is touched yet */
+    csfx__batch_t batch;
+    batch.items     = mgr->pending;
+    batch.libraries = mgr->libraries;
+    batch.count     = sorted;
+    batch.next      = 0;
+    csfx__batch_prepare(&batch, manager->threads);
+
+    int staged = 1;
+    for (idx = 0; idx < sorted; idx++)
+    {
+        staged = staged && mgr->libraries[idx] != NULL;
+    }
+
+    /* One cannot be loaded: discard all staged, nothing was touched */
+    if (!staged)
+    {
+        for (idx = 0; idx < sorted; idx++)
         {
-            CloseHandle(fileHandle);
+            csfx__managed_t* item = mgr->pending[idx];
+            if (mgr->libraries[idx])
+            {
+                csfx__library_release(mgr->libraries[idx]);
+            }
+            item->retry = 1;
         }
 
-        if (csfx__remove_file(data->pdbrpath))
+        if (count)
         {
-            int a = 0;
-            int b = 1;
-
-            a = a + b;
+            *count = num;
         }
-        else
-        {
-            int a = 0;
-            int b = 1;
+        return -1;
+    }
 
-            a = a + b;
+    /* Flip: detach dependents first, then enter dependencies first.
+     * Old versions stay mapped until every new version is entered */
+    for (idx = sorted - 1; idx >= 0; idx--)
+    {
+        csfx__managed_t* item = mgr->pending[idx];
+        data_t*          data = *(data_t**)(&item->script.internal);
+
+        mgr->olds[idx] = data->library;
+        item->libtime  = data->libtime;
+        if (data->library)
+        {
+            mgr->transitions[num].script = &item->script;
+            mgr->transitions[num].state  = csfx__script_detach(&item->script);
+            num++;
         }
     }
-#endif
-    
-    if (csfx__script_changed(script))
+
+    int failed = -1;
+    for (idx = 0; idx < sorted && failed < 0; idx++)
     {
-        void* library;
+        csfx__managed_t* item = mgr->pending[idx];
 
-        /* Unload old version */
-        library = data->library;
-        if (library)
+        mgr->transitions[num].script = &item->script;
+        mgr->transitions[num].state  = csfx__script_enter(&item->script, mgr->libraries[idx]);
+        if (mgr->transitions[num++].state == CSFX_FAILED)
         {
-            /* Raise unload event */
-            script->state = CSFX_UNLOAD;
-            csfx__call_main(script, library, script->state);
-
-            /* Collect garbage */
-            csfx__dlib_free(library);
-            data->library = NULL;
+            failed = idx;
+        }
+    }
 
-            if (script->errcode != CSFX_ERROR_NONE)
-            {
-                script->state = CSFX_FAILED;
-                return script->state;
-            }
-            else
+    if (failed < 0)
+    {
+        for (idx = 0; idx < sorted; idx++)
+        {
+            if (mgr->olds[idx])
             {
-                return script->state;
+                csfx__library_release(mgr->olds[idx]);
             }
         }
 
-        /* Create and load new temp version */
-        csfx__remove_file(data->libtpath); /* Remove temp library */
-        if (csfx__copy_file(data->librpath, data->libtpath))
+        if (count)
         {
-            library = csfx__dlib_load(data->libtpath);
-            if (library)
-            {
-                int state = script->state; /* new state */
-                state = state == CSFX_NONE ? CSFX_INIT : CSFX_RELOAD;
-                csfx__call_main(script, library, state);
-
-                data->library = library;
-                data->libtime = csfx__last_modify_time(data->librpath);
-
-                if (script->errcode != CSFX_ERROR_NONE)
-                {
-                    csfx__dlib_free(data->library);
-
-                    data->library = NULL;
-                    script->state = CSFX_FAILED;
-                }
-                else
-                {
-                    script->state = state;
-
-                #if defined(_MSC_VER) && defined(CSFX_PDB_UNLOCK)
-                # if defined(CSFX_PDB_DELETE)
-                    csfx__remove_file(data->pdbtpath);
-                    csfx__copy_file(data->pdbrpath, data->pdbtpath);
-                # endif
-                    csfx__unlock_pdb_file(data, data->pdbrpath);
-                    data->pdbtime = csfx__last_modify_time(data->pdbrpath);
-                #endif
-                }
-            }
+            *count = num;
         }
+        return 0;
+    }
 
-        return script->state;
+    /* Rollback: detach entered versions, re-enter old versions */
+    for (idx = failed; idx >= 0; idx--)
+    {
+        csfx__managed_t* item = mgr->pending[idx];
+
+        mgr->transitions[num].script = &item->script;
+        mgr->transitions[num].state  = csfx__script_detach(&item->script);
+        num++;
     }
-    else
+    for (idx = 0; idx < sorted; idx++)
     {
-        if (script->state != CSFX_FAILED)
+        csfx__managed_t* item = mgr->pending[idx];
+        csfx__library_release(mgr->libraries[idx]);
+
+        if (mgr->olds[idx])
         {
-            script->state = CSFX_NONE;
+            mgr->transitions[num].script = &item->script;
+            mgr->transitions[num].state  = csfx__script_commit(&item->script, mgr->olds[idx]);
+            num++;
+        }
+        else
+        {
+            item->script.state = CSFX_NONE; /* Never loaded, init on next try */
         }
 
-        return CSFX_NONE;
+        data_t* data  = *(data_t**)(&item->script.internal);
+        data->libtime = item->libtime;
+        item->retry   = 1;
     }
-}
-
-void* csfx_script_symbol(csfx_script_t* script, const char* name)
-{
-    typedef csfx__script_data_t data_t;
-
-    data_t** dptr = (data_t**)(&script->internal);
-    data_t*  data = *dptr;
-    return csfx__dlib_symbol(data->library, name);
-}
-
-const char* csfx_script_errmsg(const csfx_script_t* script)
-{
-    (void)script;
-    return csfx__dlib_errmsg();
-}
 
-/* @impl: csfx_watch_files */
-int csfx_watch_files(csfx_filetime_t* files, int count)
-{
-    int changed = 0;
-    for (int i = 0; i < count; i++)
+    if (count)
     {
-        if (csfx__file_changed(&files[i]))
-        {
-            changed = 1;
-        }
+        *count = num;
     }
-    return changed;
+    return -1;
 }
 
 /* END OF CSFX_IMPL */
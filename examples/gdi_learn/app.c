@@ -309,6 +309,17 @@ void app_update(csfx_script_t* script)
     case CSFX_UNLOAD:
 	app.on_paint = NULL;
 	break;
+
+    case CSFX_BUILD_FAILED:
+    {
+	const csfx_diagnostic_t* diags;
+	int count = csfx_script_diagnostics(script, &diags);
+	for (int i = 0; i < count; i++)
+	{
+	    app_loginfo("%s(%d): %s", diags[i].file, diags[i].line, diags[i].message);
+	}
+	break;
+    }
 	    
     default:
 	break;
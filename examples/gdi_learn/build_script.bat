@@ -20,7 +20,6 @@ if %ERRORLEVEL% neq 0 (
 )
 
 if %ERRORLEVEL% neq 0 (
-   pause
    set /A errno=1
 )
 
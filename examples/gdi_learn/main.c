@@ -7,27 +7,6 @@
 
 #define countof(x) (sizeof(x) / sizeof((x)[0]))
 
-static void execute_and_wait(const char* cmd)
-{
-    STARTUPINFO si;
-    PROCESS_INFORMATION pi;
-    
-    ZeroMemory(&si, sizeof(si));
-    ZeroMemory(&pi, sizeof(pi));
-    
-    si.cb = sizeof(si);
-    
-    if (CreateProcessA(NULL,
-		       (char*)cmd,
-		       NULL, NULL, FALSE, 0,
-		       NULL, NULL, &si, &pi))
-    {
-	WaitForSingleObject(pi.hProcess, INFINITE);
-	CloseHandle(pi.hThread);
-	CloseHandle(pi.hProcess);
-    }
-}
-
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 		     LPSTR cmdLine, int cmdShow)
 {   
@@ -44,6 +23,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
     csfx_script_t script;
     csfx_script_init(&script, "script.dll");
+    csfx_script_build(&script, "build_script.bat");
 
     csfx_filetime_t files[] = {
 	{ 0, "script.c" },
@@ -56,7 +36,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 	
 	if (csfx_watch_files(files, countof(files)))
 	{
-	    execute_and_wait("build_script.bat");
+	    csfx_script_compile(&script);
 	}
 	
         app_usleep(1000);